@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/cJSON.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Parse throughput of the vendored cJSON on a JSON file, by default the
+ * server list. Reports the tree parser and the SAX parser separately, along
+ * with the scanning kernel cJSON picked for this CPU.
+ *
+ * Then times member lookups: cJSON_GetObjectItem against an object index
+ * on every object in the file and on one wide object. Each index lookup is
+ * first checked to return the same item as cJSON_GetObjectItem, including
+ * duplicate and case-variant names.
+ *
+ * Usage: parse_bench [file] [iterations]
+ */
+
+#define BENCH_DEFAULT_FILE "speedtest_server_list.json"
+#define BENCH_DEFAULT_ITERATIONS 50
+#define LOOKUP_ROUNDS 20
+#define WIDE_MEMBERS 256
+#define WIDE_ROUNDS 2000
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *load_file(const char *filename, size_t *length) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error opening file: %s\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0) {
+        fprintf(stderr, "Error: Invalid file size: %s\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    char *buffer = malloc((size_t)size);
+    if (!buffer || fread(buffer, 1, (size_t)size, file) != (size_t)size) {
+        fprintf(stderr, "Error reading file: %s\n", filename);
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *length = (size_t)size;
+    return buffer;
+}
+
+static void report(const char *name, size_t length, int iterations, double elapsed) {
+    double mb = (double)length * iterations / (1024.0 * 1024.0);
+    printf("  %-5s %8.1f MB/s  (%.3f ms per parse)\n", name, mb / elapsed,
+           elapsed * 1000.0 / iterations);
+}
+
+/* Names looked up in each object of the file: the server fields, case variants and a miss */
+static const char *const file_names[] = {"host", "country", "city", "provider", "id",
+                                         "HOST", "City", "missing"};
+#define FILE_NAME_COUNT (sizeof(file_names) / sizeof(file_names[0]))
+
+enum lookup_method { LOOKUP_GET, LOOKUP_INDEX };
+
+/* Compare the index lookups with cJSON_GetObjectItem; 0 if all agree */
+static int check_lookups(const cJSON *object, const cJSON_Key *keys, size_t count) {
+    cJSON_ObjectIndex *index = cJSON_CreateObjectIndex(object);
+    int mismatches = 0;
+    size_t k;
+
+    if (!index) {
+        fprintf(stderr, "Error: Failed to create object index\n");
+        return -1;
+    }
+    for (k = 0; k < count; k++) {
+        cJSON *expected = cJSON_GetObjectItem(object, keys[k].string);
+        if (cJSON_GetIndexedItem(index, &keys[k]) != expected) {
+            fprintf(stderr, "Lookup mismatch for \"%s\"\n", keys[k].string);
+            mismatches++;
+        }
+    }
+    cJSON_DeleteObjectIndex(index);
+    return mismatches;
+}
+
+/* Look every key up in every object of the array, rounds times; returns found items */
+static unsigned long run_lookups(const cJSON *array, const cJSON_Key *keys, size_t count,
+                                 int rounds, enum lookup_method method) {
+    unsigned long found = 0;
+    const cJSON *object;
+    size_t k;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        cJSON_ArrayForEach(object, array) {
+            cJSON_ObjectIndex *index = NULL;
+            if (method == LOOKUP_INDEX) {
+                index = cJSON_CreateObjectIndex(object);
+            }
+            for (k = 0; k < count; k++) {
+                cJSON *item;
+                if (method == LOOKUP_GET) {
+                    item = cJSON_GetObjectItem(object, keys[k].string);
+                } else {
+                    item = cJSON_GetIndexedItem(index, &keys[k]);
+                }
+                found += item != NULL;
+            }
+            cJSON_DeleteObjectIndex(index);
+        }
+    }
+    return found;
+}
+
+static void report_lookups(const char *name, const cJSON *array, const cJSON_Key *keys,
+                           size_t count, int rounds, enum lookup_method method) {
+    double start = now_sec();
+    unsigned long found = run_lookups(array, keys, count, rounds, method);
+    double elapsed = now_sec() - start;
+    double lookups = (double)cJSON_GetArraySize(array) * (double)count * rounds;
+
+    printf("  %-5s %8.1f ns per lookup  (%lu found)\n", name, elapsed * 1e9 / lookups, found);
+}
+
+/*
+ * One object with WIDE_MEMBERS distinct names, followed by a duplicate and a
+ * case variant of earlier names. Wrapped in an array for run_lookups.
+ */
+static cJSON *create_wide_object(cJSON_Key *keys, char (*names)[16]) {
+    cJSON *array = cJSON_CreateArray();
+    cJSON *object = cJSON_CreateObject();
+    int i;
+
+    if (!array || !object) {
+        cJSON_Delete(array);
+        cJSON_Delete(object);
+        return NULL;
+    }
+    cJSON_AddItemToArray(array, object);
+    for (i = 0; i < WIDE_MEMBERS; i++) {
+        sprintf(names[i], "member%d", i);
+        cJSON_AddNumberToObject(object, names[i], i);
+        keys[i] = cJSON_MakeKey(names[i]);
+    }
+    cJSON_AddNumberToObject(object, "member7", -1);
+    cJSON_AddNumberToObject(object, "MEMBER9", -1);
+    keys[WIDE_MEMBERS] = cJSON_MakeKey("MEMBER7");
+    keys[WIDE_MEMBERS + 1] = cJSON_MakeKey("absent");
+    return array;
+}
+
+static int bench_lookups(const char *json, size_t length) {
+    cJSON_Key file_keys[FILE_NAME_COUNT];
+    cJSON_Key wide_keys[WIDE_MEMBERS + 2];
+    char wide_names[WIDE_MEMBERS][16];
+    const cJSON *object;
+    size_t k;
+    int failed = 0;
+
+    cJSON *tree = cJSON_ParseWithLength(json, length);
+    if (!tree) {
+        fprintf(stderr, "Parse error: %.20s\n", cJSON_GetErrorPtr());
+        return -1;
+    }
+    for (k = 0; k < FILE_NAME_COUNT; k++) {
+        file_keys[k] = cJSON_MakeKey(file_names[k]);
+    }
+    cJSON *wide = create_wide_object(wide_keys, wide_names);
+    if (!wide) {
+        cJSON_Delete(tree);
+        return -1;
+    }
+
+    /* Lookups are only worth timing if they agree with cJSON_GetObjectItem */
+    cJSON_ArrayForEach(object, tree) {
+        if (cJSON_IsObject(object) && check_lookups(object, file_keys, FILE_NAME_COUNT) != 0) {
+            failed = 1;
+        }
+    }
+    if (check_lookups(wide->child, wide_keys, WIDE_MEMBERS + 2) != 0) {
+        failed = 1;
+    }
+
+    /* An index is created per object and round, so its build cost is included */
+    if (!failed && cJSON_IsArray(tree)) {
+        printf("lookups: %d objects, %lu names, %d rounds\n", cJSON_GetArraySize(tree),
+               (unsigned long)FILE_NAME_COUNT, LOOKUP_ROUNDS);
+        report_lookups("get", tree, file_keys, FILE_NAME_COUNT, LOOKUP_ROUNDS, LOOKUP_GET);
+        report_lookups("index", tree, file_keys, FILE_NAME_COUNT, LOOKUP_ROUNDS, LOOKUP_INDEX);
+    }
+    if (!failed) {
+        printf("lookups: one object, %d members, %d rounds\n", WIDE_MEMBERS, WIDE_ROUNDS);
+        report_lookups("get", wide, wide_keys, WIDE_MEMBERS + 2, WIDE_ROUNDS, LOOKUP_GET);
+        report_lookups("index", wide, wide_keys, WIDE_MEMBERS + 2, WIDE_ROUNDS, LOOKUP_INDEX);
+    }
+
+    cJSON_Delete(wide);
+    cJSON_Delete(tree);
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = argc > 1 ? argv[1] : BENCH_DEFAULT_FILE;
+    int iterations = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "Error: iterations must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t length;
+    char *json = load_file(filename, &length);
+    if (!json) {
+        return EXIT_FAILURE;
+    }
+
+    /* All callbacks NULL: the SAX run measures the parser alone */
+    cJSON_SaxHandler handler;
+    memset(&handler, 0, sizeof(handler));
+
+    printf("%s: %lu bytes, %d iterations, %s kernel\n", filename,
+           (unsigned long)length, iterations, cJSON_ScanKernel());
+
+    int i;
+    double start = now_sec();
+    for (i = 0; i < iterations; i++) {
+        cJSON *tree = cJSON_ParseWithLength(json, length);
+        if (!tree) {
+            fprintf(stderr, "Parse error: %.20s\n", cJSON_GetErrorPtr());
+            free(json);
+            return EXIT_FAILURE;
+        }
+        cJSON_Delete(tree);
+    }
+    report("tree", length, iterations, now_sec() - start);
+
+    start = now_sec();
+    for (i = 0; i < iterations; i++) {
+        if (!cJSON_ParseSaxWithLength(json, length, &handler, NULL)) {
+            fprintf(stderr, "Parse error: %.20s\n", cJSON_GetErrorPtr());
+            free(json);
+            return EXIT_FAILURE;
+        }
+    }
+    report("sax", length, iterations, now_sec() - start);
+
+    int status = bench_lookups(json, length) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    free(json);
+    return status;
+}
@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/payload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Throughput of the upload payload generator, filling buffers the size curl
+ * asks the upload read callback for. Built with the same flags as main, so
+ * the figure applies to the shipped binary.
+ *
+ * Usage: payload_bench [seconds]
+ */
+
+#define BENCH_BUFFER_SIZE (64 * 1024)
+#define BENCH_DEFAULT_SECONDS 1.0
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : BENCH_DEFAULT_SECONDS;
+    if (seconds <= 0) {
+        fprintf(stderr, "Error: seconds must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    char *buffer = malloc(BENCH_BUFFER_SIZE);
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate buffer\n");
+        return EXIT_FAILURE;
+    }
+
+    struct payload_generator generator;
+    payload_seed(&generator, (uint64_t)time(NULL));
+
+    /* Check the clock only every 64 fills (4 MB) */
+    double start = now_sec();
+    double elapsed = 0;
+    double bytes = 0;
+    unsigned checksum = 0;
+    while (elapsed < seconds) {
+        int i;
+        for (i = 0; i < 64; i++) {
+            payload_fill(&generator, buffer, BENCH_BUFFER_SIZE);
+            checksum += (unsigned char)buffer[i];
+        }
+        bytes += 64.0 * BENCH_BUFFER_SIZE;
+        elapsed = now_sec() - start;
+    }
+
+    printf("Payload generator: %.2f GB/s (%.0f Gbps) in %d KB fills [%02x]\n",
+           bytes / elapsed / 1e9, bytes * 8.0 / elapsed / 1e9, BENCH_BUFFER_SIZE / 1024,
+           checksum & 0xFF);
+
+    free(buffer);
+    return EXIT_SUCCESS;
+}
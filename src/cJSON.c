@@ -58,6 +58,16 @@
 
 #include "cJSON.h"
 
+/* vector kernels for the string and whitespace scanners, see select_scan_kernels */
+#if !defined(CJSON_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define CJSON_SCAN_SSE2
+#include <emmintrin.h>
+#if !defined(CJSON_NO_AVX2) && (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define CJSON_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
 /* define our own boolean type */
 #ifdef true
 #undef true
@@ -158,6 +168,7 @@ typedef struct internal_hooks
     void *(CJSON_CDECL *allocate)(size_t size);
     void (CJSON_CDECL *deallocate)(void *pointer);
     void *(CJSON_CDECL *reallocate)(void *pointer, size_t size);
+    cJSON_Arena *arena; /* when set, parsing allocates from it instead */
 } internal_hooks;
 
 #if defined(_MSC_VER)
@@ -183,7 +194,7 @@ static void * CJSON_CDECL internal_realloc(void *pointer, size_t size)
 /* strlen of character literals resolved at compile time */
 #define static_strlen(string_literal) (sizeof(string_literal) - sizeof(""))
 
-static internal_hooks global_hooks = { internal_malloc, internal_free, internal_realloc };
+static internal_hooks global_hooks = { internal_malloc, internal_free, internal_realloc, NULL };
 
 static unsigned char* cJSON_strdup(const unsigned char* string, const internal_hooks * const hooks)
 {
@@ -237,10 +248,211 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
     }
 }
 
+/* Arena allocation: bump-allocate from large blocks and free them all at once */
+typedef union arena_align
+{
+    double number;
+    void *pointer;
+    long integer;
+} arena_align;
+
+#define ARENA_ALIGNMENT sizeof(arena_align)
+#define arena_round_up(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+#define ARENA_HEADER_SIZE arena_round_up(sizeof(arena_block))
+#define ARENA_DEFAULT_BLOCK_SIZE ((size_t)64 * 1024)
+
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+} arena_block;
+
+struct cJSON_Arena
+{
+    arena_block *blocks; /* the block being filled comes first */
+    size_t block_size;
+};
+
+/* the arena behind the allocation hooks installed by cJSON_InitArenaHooks */
+static cJSON_Arena *hooked_arena = NULL;
+
+static void *arena_allocate(cJSON_Arena * const arena, size_t size)
+{
+    arena_block *block = NULL;
+    size_t block_size = 0;
+
+    if ((arena == NULL) || (size > ((size_t)-1 - ARENA_HEADER_SIZE - ARENA_ALIGNMENT)))
+    {
+        return NULL;
+    }
+    size = arena_round_up(size);
+
+    block = arena->blocks;
+    if ((block != NULL) && ((block->size - block->used) >= size))
+    {
+        block->used += size;
+        return (unsigned char*)block + ARENA_HEADER_SIZE + block->used - size;
+    }
+
+    /* large allocations get a block of their own so the current block keeps filling */
+    block_size = arena->block_size;
+    if (size > (block_size / 4))
+    {
+        block_size = size;
+    }
+
+    block = (arena_block*)malloc(ARENA_HEADER_SIZE + block_size);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    block->size = block_size;
+    block->used = size;
+
+    if ((block_size == size) && (arena->blocks != NULL))
+    {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    }
+    else
+    {
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    return (unsigned char*)block + ARENA_HEADER_SIZE;
+}
+
+static void * CJSON_CDECL arena_malloc(size_t size)
+{
+    return arena_allocate(hooked_arena, size);
+}
+
+static void CJSON_CDECL arena_free(void *pointer)
+{
+    /* memory is only released together with the whole arena */
+    (void)pointer;
+}
+
+/* allocation on behalf of a parse, which may carry its own arena */
+static void *hooks_allocate(const internal_hooks * const hooks, size_t size)
+{
+    if (hooks->arena != NULL)
+    {
+        return arena_allocate(hooks->arena, size);
+    }
+
+    return hooks->allocate(size);
+}
+
+static void hooks_deallocate(const internal_hooks * const hooks, void *pointer)
+{
+    if (hooks->arena == NULL)
+    {
+        hooks->deallocate(pointer);
+    }
+}
+
+CJSON_PUBLIC(cJSON_Arena *) cJSON_CreateArena(size_t block_size)
+{
+    cJSON_Arena *arena = (cJSON_Arena*)malloc(sizeof(cJSON_Arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    arena->blocks = NULL;
+    arena->block_size = (block_size > 0) ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+
+    return arena;
+}
+
+CJSON_PUBLIC(void) cJSON_ResetArena(cJSON_Arena *arena)
+{
+    arena_block *block = NULL;
+
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    while (arena->blocks != NULL)
+    {
+        block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteArena(cJSON_Arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    if (hooked_arena == arena)
+    {
+        cJSON_InitArenaHooks(NULL);
+    }
+    cJSON_ResetArena(arena);
+    free(arena);
+}
+
+CJSON_PUBLIC(void) cJSON_InitArenaHooks(cJSON_Arena *arena)
+{
+    cJSON_Hooks hooks;
+
+    hooked_arena = arena;
+    if (arena == NULL)
+    {
+        cJSON_InitHooks(NULL);
+        return;
+    }
+
+    hooks.malloc_fn = arena_malloc;
+    hooks.free_fn = arena_free;
+    cJSON_InitHooks(&hooks);
+}
+
+static cJSON *parse_root(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, cJSON_bool insitu, cJSON_Arena *arena);
+
+/* the arena travels with the parse buffer, so the global hooks are left alone */
+static cJSON *parse_in_arena(cJSON_Arena * const arena, const char * const value, const size_t buffer_length, const cJSON_bool insitu)
+{
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    return parse_root(value, buffer_length, 0, 0, insitu, arena);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthInArena(cJSON_Arena *arena, const char *value, size_t buffer_length)
+{
+    return parse_in_arena(arena, value, buffer_length, false);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituInArena(cJSON_Arena *arena, char *value, size_t buffer_length)
+{
+    return parse_in_arena(arena, value, buffer_length, true);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInArena(cJSON_Arena *arena, const char *value)
+{
+    if (value == NULL)
+    {
+        return NULL;
+    }
+
+    return cJSON_ParseWithLengthInArena(arena, value, strlen(value) + sizeof(""));
+}
+
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 {
-    cJSON* node = (cJSON*)hooks->allocate(sizeof(cJSON));
+    cJSON* node = (cJSON*)hooks_allocate(hooks, sizeof(cJSON));
     if (node)
     {
         memset(node, '\0', sizeof(cJSON));
@@ -249,32 +461,45 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
     return node;
 }
 
-/* Delete a cJSON structure. */
-CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+/* Delete a cJSON structure allocated with the given hooks. */
+static void delete_item(cJSON *item, const internal_hooks * const hooks)
 {
     cJSON *next = NULL;
+
+    if (hooks->arena != NULL)
+    {
+        /* released together with the arena */
+        return;
+    }
+
     while (item != NULL)
     {
         next = item->next;
         if (!(item->type & cJSON_IsReference) && (item->child != NULL))
         {
-            cJSON_Delete(item->child);
+            delete_item(item->child, hooks);
         }
         if (!(item->type & cJSON_IsReference) && (item->valuestring != NULL))
         {
-            global_hooks.deallocate(item->valuestring);
+            hooks->deallocate(item->valuestring);
             item->valuestring = NULL;
         }
         if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
         {
-            global_hooks.deallocate(item->string);
+            hooks->deallocate(item->string);
             item->string = NULL;
         }
-        global_hooks.deallocate(item);
+        hooks->deallocate(item);
         item = next;
     }
 }
 
+/* Delete a cJSON structure. */
+CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+{
+    delete_item(item, &global_hooks);
+}
+
 /* get the decimal point character of the current locale */
 static unsigned char get_decimal_point(void)
 {
@@ -293,6 +518,7 @@ typedef struct
     size_t offset;
     size_t depth; /* How deeply nested (in arrays/objects) is the input at the current offset. */
     internal_hooks hooks;
+    cJSON_bool insitu; /* content is writable and strings are unescaped in place */
 } parse_buffer;
 
 /* check if the given size is left to read in a given parse buffer (starting with 1) */
@@ -303,139 +529,450 @@ typedef struct
 /* get a pointer to the buffer at the position */
 #define buffer_at_offset(buffer) ((buffer)->content + (buffer)->offset)
 
-/* Parse the input text to generate a number, and populate the result into item. */
-static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
+/* Scanning kernels. Each returns the index of the first byte of interest among the length bytes at input,
+ * or length if there is none, and never reads past them. */
+
+/* first byte that is not whitespace; like the rest of the parser, every byte up to space counts as whitespace */
+static size_t scan_whitespace_scalar(const unsigned char * const input, const size_t length)
 {
-    double number = 0;
-    unsigned char *after_end = NULL;
-    unsigned char *number_c_string;
-    unsigned char decimal_point = get_decimal_point();
     size_t i = 0;
-    size_t number_string_length = 0;
-    cJSON_bool has_decimal_point = false;
 
-    if ((input_buffer == NULL) || (input_buffer->content == NULL))
+    while ((i < length) && (input[i] <= 32))
     {
-        return false;
+        i++;
     }
 
-    /* copy the number into a temporary buffer and replace '.' with the decimal point
-     * of the current locale (for strtod)
-     * This also takes care of '\0' not necessarily being available for marking the end of the input */
-    for (i = 0; can_access_at_index(input_buffer, i); i++)
-    {
-        switch (buffer_at_offset(input_buffer)[i])
-        {
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-            case '+':
-            case '-':
-            case 'e':
-            case 'E':
-                number_string_length++;
-                break;
+    return i;
+}
 
-            case '.':
-                number_string_length++;
-                has_decimal_point = true;
-                break;
+/* first quote or backslash */
+static size_t scan_string_scalar(const unsigned char * const input, const size_t length)
+{
+    size_t i = 0;
 
-            default:
-                goto loop_end;
-        }
-    }
-loop_end:
-    /* malloc for temporary buffer, add 1 for '\0' */
-    number_c_string = (unsigned char *) input_buffer->hooks.allocate(number_string_length + 1);
-    if (number_c_string == NULL)
+    while ((i < length) && (input[i] != '\"') && (input[i] != '\\'))
     {
-        return false; /* allocation failure */
+        i++;
     }
 
-    memcpy(number_c_string, buffer_at_offset(input_buffer), number_string_length);
-    number_c_string[number_string_length] = '\0';
+    return i;
+}
 
-    if (has_decimal_point)
+#if defined(CJSON_SCAN_SSE2)
+static size_t scan_whitespace_sse2(const unsigned char * const input, const size_t length)
+{
+    const __m128i space = _mm_set1_epi8(32);
+    size_t i = 0;
+
+    for (i = 0; (length - i) >= 16; i += 16)
     {
-        for (i = 0; i < number_string_length; i++)
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        /* max(c, 32) is 32 exactly for whitespace */
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, space), space)) ^ 0xFFFFU;
+        if (mask != 0)
         {
-            if (number_c_string[i] == '.')
-            {
-                /* replace '.' with the decimal point of the current locale (for strtod) */
-                number_c_string[i] = decimal_point;
-            }
+            return i + (size_t)__builtin_ctz(mask);
         }
     }
 
-    number = strtod((const char*)number_c_string, (char**)&after_end);
-    if (number_c_string == after_end)
+    return i + scan_whitespace_scalar(input + i, length - i);
+}
+
+static size_t scan_string_sse2(const unsigned char * const input, const size_t length)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (i = 0; (length - i) >= 16; i += 16)
     {
-        /* free the temporary buffer */
-        input_buffer->hooks.deallocate(number_c_string);
-        return false; /* parse_error */
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(input + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
     }
 
-    item->valuedouble = number;
+    return i + scan_string_scalar(input + i, length - i);
+}
+#endif
 
-    /* use saturation in case of overflow */
-    if (number >= INT_MAX)
+#if defined(CJSON_SCAN_AVX2)
+__attribute__((target("avx2")))
+static size_t scan_whitespace_avx2(const unsigned char * const input, const size_t length)
+{
+    const __m256i space = _mm256_set1_epi8(32);
+    size_t i = 0;
+
+    for (i = 0; (length - i) >= 32; i += 32)
     {
-        item->valueint = INT_MAX;
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(input + i));
+        unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chunk, space), space));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
     }
-    else if (number <= (double)INT_MIN)
+
+    return i + scan_whitespace_sse2(input + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_string_avx2(const unsigned char * const input, const size_t length)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (i = 0; (length - i) >= 32; i += 32)
     {
-        item->valueint = INT_MIN;
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(input + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
     }
-    else
+
+    return i + scan_string_sse2(input + i, length - i);
+}
+#endif
+
+typedef size_t (*scan_kernel)(const unsigned char * const input, const size_t length);
+
+static size_t scan_whitespace_first(const unsigned char * const input, const size_t length);
+static size_t scan_string_first(const unsigned char * const input, const size_t length);
+
+/* the kernels start out as stubs that pick the real ones on first use */
+static scan_kernel scan_whitespace = scan_whitespace_first;
+static scan_kernel scan_string = scan_string_first;
+static const char *scan_kernel_name = NULL;
+
+/* Use the widest vector unit the CPU has. Racing threads all store the same values. */
+static void select_scan_kernels(void)
+{
+#if defined(CJSON_SCAN_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
     {
-        item->valueint = (int)number;
+        scan_whitespace = scan_whitespace_avx2;
+        scan_string = scan_string_avx2;
+        scan_kernel_name = "avx2";
+        return;
     }
+#endif
+#if defined(CJSON_SCAN_SSE2)
+    scan_whitespace = scan_whitespace_sse2;
+    scan_string = scan_string_sse2;
+    scan_kernel_name = "sse2";
+#else
+    scan_whitespace = scan_whitespace_scalar;
+    scan_string = scan_string_scalar;
+    scan_kernel_name = "scalar";
+#endif
+}
 
-    item->type = cJSON_Number;
+static size_t scan_whitespace_first(const unsigned char * const input, const size_t length)
+{
+    select_scan_kernels();
+    return scan_whitespace(input, length);
+}
 
-    input_buffer->offset += (size_t)(after_end - number_c_string);
-    /* free the temporary buffer */
-    input_buffer->hooks.deallocate(number_c_string);
-    return true;
+static size_t scan_string_first(const unsigned char * const input, const size_t length)
+{
+    select_scan_kernels();
+    return scan_string(input, length);
 }
 
-/* don't ask me, but the original cJSON_SetNumberValue returns an integer or double */
-CJSON_PUBLIC(double) cJSON_SetNumberHelper(cJSON *object, double number)
+CJSON_PUBLIC(const char*) cJSON_ScanKernel(void)
 {
-    if (number >= INT_MAX)
-    {
-        object->valueint = INT_MAX;
-    }
-    else if (number <= (double)INT_MIN)
-    {
-        object->valueint = INT_MIN;
-    }
-    else
+    if (scan_kernel_name == NULL)
     {
-        object->valueint = (int)number;
+        select_scan_kernels();
     }
 
-    return object->valuedouble = number;
+    return scan_kernel_name;
 }
 
-/* Note: when passing a NULL valuestring, cJSON_SetValuestring treats this as an error and return NULL */
-CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
+/* The fast number path relies on double arithmetic being rounded once, to double precision */
+#if (defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0)) || (defined(__FLT_EVAL_METHOD__) && (__FLT_EVAL_METHOD__ == 0))
+#define CJSON_FAST_NUMBERS
+#endif
+
+#if defined(CJSON_FAST_NUMBERS)
+
+/* the powers of ten that are exact doubles */
+static const double exact_powers_of_ten[] =
 {
-    char *copy = NULL;
-    size_t v1_len;
-    size_t v2_len;
-    /* if object's type is not cJSON_String or is cJSON_IsReference, it should not set valuestring */
-    if ((object == NULL) || !(object->type & cJSON_String) || (object->type & cJSON_IsReference))
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Convert the common number shapes without strtod. Integers of up to 15 significant digits convert exactly,
+ * and so does anything with up to 15 significant digits and a decimal exponent within +-22 (Clinger's fast path:
+ * both operands are exact doubles, so one multiplication or division rounds correctly).
+ * Returns false for anything else, including text strtod would read differently, so the caller falls back.
+ * On success *length is the number of bytes the number takes. */
+static cJSON_bool parse_number_fast(const parse_buffer * const input_buffer, double * const number, size_t * const length)
+{
+    const unsigned char *input = buffer_at_offset(input_buffer);
+    const unsigned char * const input_end = input_buffer->content + input_buffer->length;
+    const unsigned char *start = input;
+    const unsigned char *digits = NULL;
+    double significand = 0; /* below 10^15, so every step is exact */
+    cJSON_bool nonzero = false;
+    int significant_digits = 0;
+    int fraction_digits = 0;
+    int exponent = 0;
+    cJSON_bool negative = false;
+
+    if ((input < input_end) && (*input == '-'))
     {
-        return NULL;
+        negative = true;
+        input++;
+    }
+
+    /* integer part */
+    digits = input;
+    for (; (input < input_end) && (*input >= '0') && (*input <= '9'); input++)
+    {
+        nonzero = nonzero || (*input != '0');
+        if (nonzero && (++significant_digits > 15))
+        {
+            return false;
+        }
+        significand = significand * 10 + (*input - '0');
+    }
+    if (input == digits)
+    {
+        return false; /* strtod decides about "-" and "-.5" */
+    }
+
+    /* fraction */
+    if ((input < input_end) && (*input == '.'))
+    {
+        input++;
+        digits = input;
+        for (; (input < input_end) && (*input >= '0') && (*input <= '9'); input++)
+        {
+            nonzero = nonzero || (*input != '0');
+            if ((nonzero && (++significant_digits > 15)) || (++fraction_digits > 10000))
+            {
+                return false;
+            }
+            significand = significand * 10 + (*input - '0');
+        }
+        if (input == digits)
+        {
+            return false; /* "1." */
+        }
+    }
+
+    /* exponent */
+    if ((input < input_end) && ((*input == 'e') || (*input == 'E')))
+    {
+        cJSON_bool negative_exponent = false;
+
+        input++;
+        if ((input < input_end) && ((*input == '+') || (*input == '-')))
+        {
+            negative_exponent = (*input == '-');
+            input++;
+        }
+        digits = input;
+        for (; (input < input_end) && (*input >= '0') && (*input <= '9'); input++)
+        {
+            if (exponent < 10000)
+            {
+                exponent = exponent * 10 + (*input - '0');
+            }
+        }
+        if (input == digits)
+        {
+            return false; /* "1e", strtod leaves the exponent unread */
+        }
+        if (negative_exponent)
+        {
+            exponent = -exponent;
+        }
+    }
+    exponent -= fraction_digits;
+
+    if (!nonzero)
+    {
+        significand = 0; /* any exponent */
+    }
+    else if ((exponent > 22) || (exponent < -22))
+    {
+        return false;
+    }
+    else if (exponent > 0)
+    {
+        significand *= exact_powers_of_ten[exponent];
+    }
+    else if (exponent < 0)
+    {
+        significand /= exact_powers_of_ten[-exponent];
+    }
+
+    *number = negative ? -significand : significand;
+    *length = (size_t)(input - start);
+    return true;
+}
+#endif
+
+/* Parse the input text to generate a number, and populate the result into item. */
+static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
+{
+    double number = 0;
+    unsigned char *after_end = NULL;
+    unsigned char *number_c_string;
+    unsigned char number_buffer[64]; /* short numbers don't need an allocation */
+    unsigned char decimal_point = '.';
+    size_t i = 0;
+    size_t number_string_length = 0;
+    cJSON_bool has_decimal_point = false;
+
+    if ((input_buffer == NULL) || (input_buffer->content == NULL))
+    {
+        return false;
+    }
+
+#if defined(CJSON_FAST_NUMBERS)
+    if (parse_number_fast(input_buffer, &number, &number_string_length))
+    {
+        goto store_number;
+    }
+#endif
+
+    /* copy the number into a temporary buffer and replace '.' with the decimal point
+     * of the current locale (for strtod)
+     * This also takes care of '\0' not necessarily being available for marking the end of the input */
+    for (i = 0; can_access_at_index(input_buffer, i); i++)
+    {
+        switch (buffer_at_offset(input_buffer)[i])
+        {
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+            case '+':
+            case '-':
+            case 'e':
+            case 'E':
+                number_string_length++;
+                break;
+
+            case '.':
+                number_string_length++;
+                has_decimal_point = true;
+                break;
+
+            default:
+                goto loop_end;
+        }
+    }
+loop_end:
+    number_c_string = number_buffer;
+    if (number_string_length >= sizeof(number_buffer))
+    {
+        /* malloc for temporary buffer, add 1 for '\0' */
+        number_c_string = (unsigned char *) hooks_allocate(&input_buffer->hooks, number_string_length + 1);
+        if (number_c_string == NULL)
+        {
+            return false; /* allocation failure */
+        }
+    }
+
+    memcpy(number_c_string, buffer_at_offset(input_buffer), number_string_length);
+    number_c_string[number_string_length] = '\0';
+
+    if (has_decimal_point)
+    {
+        decimal_point = get_decimal_point();
+        for (i = 0; i < number_string_length; i++)
+        {
+            if (number_c_string[i] == '.')
+            {
+                /* replace '.' with the decimal point of the current locale (for strtod) */
+                number_c_string[i] = decimal_point;
+            }
+        }
+    }
+
+    number = strtod((const char*)number_c_string, (char**)&after_end);
+    number_string_length = (size_t)(after_end - number_c_string);
+    /* free the temporary buffer */
+    if (number_c_string != number_buffer)
+    {
+        hooks_deallocate(&input_buffer->hooks, number_c_string);
+    }
+    if (number_string_length == 0)
+    {
+        return false; /* parse_error */
+    }
+
+#if defined(CJSON_FAST_NUMBERS)
+store_number:
+#endif
+    item->valuedouble = number;
+
+    /* use saturation in case of overflow */
+    if (number >= INT_MAX)
+    {
+        item->valueint = INT_MAX;
+    }
+    else if (number <= (double)INT_MIN)
+    {
+        item->valueint = INT_MIN;
+    }
+    else
+    {
+        item->valueint = (int)number;
+    }
+
+    item->type = cJSON_Number;
+
+    input_buffer->offset += number_string_length;
+    return true;
+}
+
+/* don't ask me, but the original cJSON_SetNumberValue returns an integer or double */
+CJSON_PUBLIC(double) cJSON_SetNumberHelper(cJSON *object, double number)
+{
+    if (number >= INT_MAX)
+    {
+        object->valueint = INT_MAX;
+    }
+    else if (number <= (double)INT_MIN)
+    {
+        object->valueint = INT_MIN;
+    }
+    else
+    {
+        object->valueint = (int)number;
+    }
+
+    return object->valuedouble = number;
+}
+
+/* Note: when passing a NULL valuestring, cJSON_SetValuestring treats this as an error and return NULL */
+CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
+{
+    char *copy = NULL;
+    size_t v1_len;
+    size_t v2_len;
+    /* if object's type is not cJSON_String or is cJSON_IsReference, it should not set valuestring */
+    if ((object == NULL) || !(object->type & cJSON_String) || (object->type & cJSON_IsReference))
+    {
+        return NULL;
     }
     /* return NULL if the object is corrupted or valuestring is NULL */
     if (object->valuestring == NULL || valuestring == NULL)
@@ -815,71 +1352,65 @@ fail:
     return 0;
 }
 
-/* Parse the input text into an unescaped cinput, and populate item. */
-static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer)
+/* Find the closing quote of the string literal at the current offset and count its escape sequences.
+ * Returns NULL if the literal is not terminated inside the buffer. */
+static const unsigned char *find_string_end(const parse_buffer * const input_buffer, size_t * const escape_count)
 {
-    const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
     const unsigned char *input_end = buffer_at_offset(input_buffer) + 1;
-    unsigned char *output_pointer = NULL;
-    unsigned char *output = NULL;
-
-    /* not a string */
-    if (buffer_at_offset(input_buffer)[0] != '\"')
-    {
-        goto fail;
-    }
+    const unsigned char * const buffer_end = input_buffer->content + input_buffer->length;
+    size_t skipped_bytes = 0;
 
+    for (;;)
     {
-        /* calculate approximate size of the output (overestimate) */
-        size_t allocation_length = 0;
-        size_t skipped_bytes = 0;
-        while (((size_t)(input_end - input_buffer->content) < input_buffer->length) && (*input_end != '\"'))
-        {
-            /* is escape sequence */
-            if (input_end[0] == '\\')
-            {
-                if ((size_t)(input_end + 1 - input_buffer->content) >= input_buffer->length)
-                {
-                    /* prevent buffer overflow when last input character is a backslash */
-                    goto fail;
-                }
-                skipped_bytes++;
-                input_end++;
-            }
-            input_end++;
-        }
-        if (((size_t)(input_end - input_buffer->content) >= input_buffer->length) || (*input_end != '\"'))
+        /* jump to the next quote or backslash */
+        input_end += scan_string(input_end, (size_t)(buffer_end - input_end));
+        if ((input_end >= buffer_end) || (*input_end == '\"'))
         {
-            goto fail; /* string ended unexpectedly */
+            break;
         }
 
-        /* This is at most how much we need for the output */
-        allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-        output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
-        if (output == NULL)
+        /* is escape sequence */
+        if ((input_end + 1) >= buffer_end)
         {
-            goto fail; /* allocation failure */
+            /* prevent buffer overflow when last input character is a backslash */
+            return NULL;
         }
+        skipped_bytes++;
+        input_end += 2;
     }
+    if (input_end >= buffer_end)
+    {
+        return NULL; /* string ended unexpectedly */
+    }
+
+    *escape_count = skipped_bytes;
+    return input_end;
+}
+
+/* Unescape the string literal contents from *input_pointer up to input_end into output.
+ * Returns the end of the output, or NULL on an invalid escape sequence, in which case
+ * *input_pointer is left at that sequence. output may alias the input. */
+static unsigned char *unescape_string(const unsigned char ** const input_pointer, const unsigned char * const input_end, unsigned char *output_pointer)
+{
+    const unsigned char *input = *input_pointer;
 
-    output_pointer = output;
     /* loop through the string literal */
-    while (input_pointer < input_end)
+    while (input < input_end)
     {
-        if (*input_pointer != '\\')
+        if (*input != '\\')
         {
-            *output_pointer++ = *input_pointer++;
+            *output_pointer++ = *input++;
         }
         /* escape sequence */
         else
         {
             unsigned char sequence_length = 2;
-            if ((input_end - input_pointer) < 1)
+            if ((input_end - input) < 1)
             {
                 goto fail;
             }
 
-            switch (input_pointer[1])
+            switch (input[1])
             {
                 case 'b':
                     *output_pointer++ = '\b';
@@ -899,12 +1430,12 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
                 case '\"':
                 case '\\':
                 case '/':
-                    *output_pointer++ = input_pointer[1];
+                    *output_pointer++ = input[1];
                     break;
 
                 /* UTF-16 literal */
                 case 'u':
-                    sequence_length = utf16_literal_to_utf8(input_pointer, input_end, &output_pointer);
+                    sequence_length = utf16_literal_to_utf8(input, input_end, &output_pointer);
                     if (sequence_length == 0)
                     {
                         /* failed to convert UTF16-literal to UTF-8 */
@@ -915,10 +1446,76 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
                 default:
                     goto fail;
             }
-            input_pointer += sequence_length;
+            input += sequence_length;
         }
     }
 
+    *input_pointer = input;
+    return output_pointer;
+
+fail:
+    *input_pointer = input;
+    return NULL;
+}
+
+/* Parse the input text into an unescaped cinput, and populate item. */
+static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer)
+{
+    const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
+    const unsigned char *input_end = NULL;
+    unsigned char *output_pointer = NULL;
+    unsigned char *output = NULL;
+    size_t skipped_bytes = 0;
+
+    /* not a string */
+    if (buffer_at_offset(input_buffer)[0] != '\"')
+    {
+        goto fail;
+    }
+
+    input_end = find_string_end(input_buffer, &skipped_bytes);
+    if (input_end == NULL)
+    {
+        goto fail;
+    }
+
+    if (input_buffer->insitu)
+    {
+        /* unescaping never grows a string, so the literal can be rewritten where it is;
+         * the terminator lands on the closing quote at the latest */
+        output = (unsigned char*)input_pointer;
+        if ((output_pointer = unescape_string(&input_pointer, input_end, output)) == NULL)
+        {
+            output = NULL; /* not ours to free */
+            goto fail;
+        }
+        *output_pointer = '\0';
+
+        item->type = cJSON_String | cJSON_IsReference;
+        item->valuestring = (char*)output;
+
+        input_buffer->offset = (size_t) (input_end - input_buffer->content);
+        input_buffer->offset++;
+
+        return true;
+    }
+
+    {
+        /* This is at most how much we need for the output (overestimate) */
+        size_t allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
+        output = (unsigned char*)hooks_allocate(&input_buffer->hooks, allocation_length + sizeof(""));
+        if (output == NULL)
+        {
+            goto fail; /* allocation failure */
+        }
+    }
+
+    output_pointer = unescape_string(&input_pointer, input_end, output);
+    if (output_pointer == NULL)
+    {
+        goto fail;
+    }
+
     /* zero terminate the output */
     *output_pointer = '\0';
 
@@ -933,7 +1530,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 fail:
     if (output != NULL)
     {
-        input_buffer->hooks.deallocate(output);
+        hooks_deallocate(&input_buffer->hooks, output);
         output = NULL;
     }
 
@@ -1061,135 +1658,505 @@ static cJSON_bool print_string_ptr(const unsigned char * const input, printbuffe
             }
         }
     }
-    output[output_length + 1] = '\"';
-    output[output_length + 2] = '\0';
+    output[output_length + 1] = '\"';
+    output[output_length + 2] = '\0';
+
+    return true;
+}
+
+/* Invoke print_string_ptr (which is useful) on an item. */
+static cJSON_bool print_string(const cJSON * const item, printbuffer * const p)
+{
+    return print_string_ptr((unsigned char*)item->valuestring, p);
+}
+
+/* Predeclare these prototypes. */
+static cJSON_bool parse_value(cJSON * const item, parse_buffer * const input_buffer);
+static cJSON_bool print_value(const cJSON * const item, printbuffer * const output_buffer);
+static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buffer);
+static cJSON_bool print_array(const cJSON * const item, printbuffer * const output_buffer);
+static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_buffer);
+static cJSON_bool print_object(const cJSON * const item, printbuffer * const output_buffer);
+
+/* Utility to jump whitespace and cr/lf */
+static parse_buffer *buffer_skip_whitespace(parse_buffer * const buffer)
+{
+    if ((buffer == NULL) || (buffer->content == NULL))
+    {
+        return NULL;
+    }
+
+    if (cannot_access_at_index(buffer, 0) || (buffer_at_offset(buffer)[0] > 32))
+    {
+        return buffer;
+    }
+
+    buffer->offset += scan_whitespace(buffer_at_offset(buffer), buffer->length - buffer->offset);
+
+    if (buffer->offset == buffer->length)
+    {
+        buffer->offset--;
+    }
+
+    return buffer;
+}
+
+/* skip the UTF-8 BOM (byte order mark) if it is at the beginning of a buffer */
+static parse_buffer *skip_utf8_bom(parse_buffer * const buffer)
+{
+    if ((buffer == NULL) || (buffer->content == NULL) || (buffer->offset != 0))
+    {
+        return NULL;
+    }
+
+    if (can_access_at_index(buffer, 4) && (strncmp((const char*)buffer_at_offset(buffer), "\xEF\xBB\xBF", 3) == 0))
+    {
+        buffer->offset += 3;
+    }
+
+    return buffer;
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    size_t buffer_length;
+
+    if (NULL == value)
+    {
+        return NULL;
+    }
+
+    /* Adding null character size due to require_null_terminated. */
+    buffer_length = strlen(value) + sizeof("");
+
+    return cJSON_ParseWithLengthOpts(value, buffer_length, return_parse_end, require_null_terminated);
+}
+
+/* Parse an object - create a new root, and populate. */
+static cJSON *parse_root(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, cJSON_bool insitu, cJSON_Arena *arena)
+{
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0, 0 }, 0 };
+    cJSON *item = NULL;
+
+    /* reset error position */
+    global_error.json = NULL;
+    global_error.position = 0;
+
+    if (value == NULL || 0 == buffer_length)
+    {
+        goto fail;
+    }
+
+    buffer.content = (const unsigned char*)value;
+    buffer.length = buffer_length;
+    buffer.offset = 0;
+    buffer.hooks = global_hooks;
+    buffer.hooks.arena = arena;
+    buffer.insitu = insitu;
+
+    item = cJSON_New_Item(&buffer.hooks);
+    if (item == NULL) /* memory fail */
+    {
+        goto fail;
+    }
+
+    if (!parse_value(item, buffer_skip_whitespace(skip_utf8_bom(&buffer))))
+    {
+        /* parse failure. ep is set. */
+        goto fail;
+    }
+
+    /* if we require null-terminated JSON without appended garbage, skip and then check for a null terminator */
+    if (require_null_terminated)
+    {
+        buffer_skip_whitespace(&buffer);
+        if ((buffer.offset >= buffer.length) || buffer_at_offset(&buffer)[0] != '\0')
+        {
+            goto fail;
+        }
+    }
+    if (return_parse_end)
+    {
+        *return_parse_end = (const char*)buffer_at_offset(&buffer);
+    }
+
+    return item;
+
+fail:
+    if (item != NULL)
+    {
+        delete_item(item, &buffer.hooks);
+    }
+
+    if (value != NULL)
+    {
+        error local_error;
+        local_error.json = (const unsigned char*)value;
+        local_error.position = 0;
+
+        if (buffer.offset < buffer.length)
+        {
+            local_error.position = buffer.offset;
+        }
+        else if (buffer.length > 0)
+        {
+            local_error.position = buffer.length - 1;
+        }
+
+        if (return_parse_end != NULL)
+        {
+            *return_parse_end = (const char*)local_error.json + local_error.position;
+        }
+
+        global_error = local_error;
+    }
+
+    return NULL;
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    return parse_root(value, buffer_length, return_parse_end, require_null_terminated, false, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituOpts(char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    return parse_root(value, buffer_length, return_parse_end, require_null_terminated, true, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSitu(char *value, size_t buffer_length)
+{
+    return parse_root(value, buffer_length, 0, 0, true, NULL);
+}
+
+/* Default options for cJSON_Parse */
+CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
+{
+    return cJSON_ParseWithOpts(value, 0, 0);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_length)
+{
+    return cJSON_ParseWithLengthOpts(value, buffer_length, 0, 0);
+}
+
+/* Event-driven parsing */
+typedef struct
+{
+    parse_buffer buffer;
+    const cJSON_SaxHandler *handler;
+    void *context;
+    unsigned char *scratch; /* unescaped copy of the current string, when it has escapes */
+    size_t scratch_size;
+} sax_parser;
+
+static cJSON_bool sax_parse_value(sax_parser * const parser);
+
+/* Report the string literal at the current offset as a key or a string value. */
+static cJSON_bool sax_parse_string(sax_parser * const parser, const cJSON_bool is_key)
+{
+    parse_buffer * const input_buffer = &(parser->buffer);
+    const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
+    const unsigned char *input_end = NULL;
+    const unsigned char *value = input_pointer;
+    size_t length = 0;
+    size_t escape_count = 0;
+    cJSON_bool (*callback)(void *context, const char *value, size_t length) = is_key ? parser->handler->key : parser->handler->string;
+
+    if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != '\"'))
+    {
+        return false; /* not a string */
+    }
+
+    input_end = find_string_end(input_buffer, &escape_count);
+    if (input_end == NULL)
+    {
+        input_buffer->offset++;
+        return false;
+    }
+
+    if (escape_count == 0)
+    {
+        /* nothing to unescape, hand out the input itself */
+        length = (size_t)(input_end - input_pointer);
+    }
+    else
+    {
+        /* unescape even without a callback, which validates the escape sequences */
+        unsigned char *output_end = NULL;
+        size_t needed = (size_t)(input_end - input_pointer) - escape_count + sizeof("");
+
+        if (needed > parser->scratch_size)
+        {
+            unsigned char *scratch = (unsigned char*)input_buffer->hooks.allocate(needed);
+            if (scratch == NULL)
+            {
+                return false; /* allocation failure */
+            }
+            if (parser->scratch != NULL)
+            {
+                input_buffer->hooks.deallocate(parser->scratch);
+            }
+            parser->scratch = scratch;
+            parser->scratch_size = needed;
+        }
+
+        output_end = unescape_string(&input_pointer, input_end, parser->scratch);
+        if (output_end == NULL)
+        {
+            input_buffer->offset = (size_t)(input_pointer - input_buffer->content);
+            return false;
+        }
+        *output_end = '\0';
+
+        value = parser->scratch;
+        length = (size_t)(output_end - parser->scratch);
+    }
+
+    input_buffer->offset = (size_t)(input_end - input_buffer->content) + 1;
+
+    return (callback == NULL) || callback(parser->context, (const char*)value, length);
+}
+
+static cJSON_bool sax_parse_array(sax_parser * const parser)
+{
+    parse_buffer * const input_buffer = &(parser->buffer);
+    const cJSON_SaxHandler * const handler = parser->handler;
+
+    if (input_buffer->depth >= CJSON_NESTING_LIMIT)
+    {
+        return false; /* to deeply nested */
+    }
+    input_buffer->depth++;
+
+    if ((handler->start_array != NULL) && !handler->start_array(parser->context))
+    {
+        return false;
+    }
+
+    input_buffer->offset++;
+    buffer_skip_whitespace(input_buffer);
+    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ']'))
+    {
+        goto success; /* empty array */
+    }
+
+    /* check if we skipped to the end of the buffer */
+    if (cannot_access_at_index(input_buffer, 0))
+    {
+        input_buffer->offset--;
+        return false;
+    }
+
+    /* step back to character in front of the first element */
+    input_buffer->offset--;
+    /* loop through the comma separated array elements */
+    do
+    {
+        input_buffer->offset++;
+        buffer_skip_whitespace(input_buffer);
+        if (!sax_parse_value(parser))
+        {
+            return false; /* failed to parse value */
+        }
+        buffer_skip_whitespace(input_buffer);
+    }
+    while (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ','));
 
-    return true;
-}
+    if (cannot_access_at_index(input_buffer, 0) || buffer_at_offset(input_buffer)[0] != ']')
+    {
+        return false; /* expected end of array */
+    }
 
-/* Invoke print_string_ptr (which is useful) on an item. */
-static cJSON_bool print_string(const cJSON * const item, printbuffer * const p)
-{
-    return print_string_ptr((unsigned char*)item->valuestring, p);
-}
+success:
+    input_buffer->depth--;
+    input_buffer->offset++;
 
-/* Predeclare these prototypes. */
-static cJSON_bool parse_value(cJSON * const item, parse_buffer * const input_buffer);
-static cJSON_bool print_value(const cJSON * const item, printbuffer * const output_buffer);
-static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buffer);
-static cJSON_bool print_array(const cJSON * const item, printbuffer * const output_buffer);
-static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_buffer);
-static cJSON_bool print_object(const cJSON * const item, printbuffer * const output_buffer);
+    return (handler->end_array == NULL) || handler->end_array(parser->context);
+}
 
-/* Utility to jump whitespace and cr/lf */
-static parse_buffer *buffer_skip_whitespace(parse_buffer * const buffer)
+static cJSON_bool sax_parse_object(sax_parser * const parser)
 {
-    if ((buffer == NULL) || (buffer->content == NULL))
+    parse_buffer * const input_buffer = &(parser->buffer);
+    const cJSON_SaxHandler * const handler = parser->handler;
+
+    if (input_buffer->depth >= CJSON_NESTING_LIMIT)
     {
-        return NULL;
+        return false; /* to deeply nested */
     }
+    input_buffer->depth++;
 
-    if (cannot_access_at_index(buffer, 0))
+    if ((handler->start_object != NULL) && !handler->start_object(parser->context))
     {
-        return buffer;
+        return false;
     }
 
-    while (can_access_at_index(buffer, 0) && (buffer_at_offset(buffer)[0] <= 32))
+    input_buffer->offset++;
+    buffer_skip_whitespace(input_buffer);
+    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '}'))
     {
-       buffer->offset++;
+        goto success; /* empty object */
     }
 
-    if (buffer->offset == buffer->length)
+    /* check if we skipped to the end of the buffer */
+    if (cannot_access_at_index(input_buffer, 0))
     {
-        buffer->offset--;
+        input_buffer->offset--;
+        return false;
     }
 
-    return buffer;
-}
-
-/* skip the UTF-8 BOM (byte order mark) if it is at the beginning of a buffer */
-static parse_buffer *skip_utf8_bom(parse_buffer * const buffer)
-{
-    if ((buffer == NULL) || (buffer->content == NULL) || (buffer->offset != 0))
+    /* step back to character in front of the first element */
+    input_buffer->offset--;
+    /* loop through the comma separated members */
+    do
     {
-        return NULL;
+        if (cannot_access_at_index(input_buffer, 1))
+        {
+            return false; /* nothing comes after the comma */
+        }
+
+        /* parse the name of the member */
+        input_buffer->offset++;
+        buffer_skip_whitespace(input_buffer);
+        if (!sax_parse_string(parser, true))
+        {
+            return false; /* failed to parse name */
+        }
+        buffer_skip_whitespace(input_buffer);
+
+        if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != ':'))
+        {
+            return false; /* invalid object */
+        }
+
+        /* parse the value */
+        input_buffer->offset++;
+        buffer_skip_whitespace(input_buffer);
+        if (!sax_parse_value(parser))
+        {
+            return false; /* failed to parse value */
+        }
+        buffer_skip_whitespace(input_buffer);
     }
+    while (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ','));
 
-    if (can_access_at_index(buffer, 4) && (strncmp((const char*)buffer_at_offset(buffer), "\xEF\xBB\xBF", 3) == 0))
+    if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != '}'))
     {
-        buffer->offset += 3;
+        return false; /* expected end of object */
     }
 
-    return buffer;
+success:
+    input_buffer->depth--;
+    input_buffer->offset++;
+
+    return (handler->end_object == NULL) || handler->end_object(parser->context);
 }
 
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+static cJSON_bool sax_parse_value(sax_parser * const parser)
 {
-    size_t buffer_length;
+    parse_buffer * const input_buffer = &(parser->buffer);
+    const cJSON_SaxHandler * const handler = parser->handler;
 
-    if (NULL == value)
+    /* null */
+    if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "null", 4) == 0))
     {
-        return NULL;
+        input_buffer->offset += 4;
+        return (handler->null == NULL) || handler->null(parser->context);
+    }
+    /* false */
+    if (can_read(input_buffer, 5) && (strncmp((const char*)buffer_at_offset(input_buffer), "false", 5) == 0))
+    {
+        input_buffer->offset += 5;
+        return (handler->boolean == NULL) || handler->boolean(parser->context, false);
+    }
+    /* true */
+    if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "true", 4) == 0))
+    {
+        input_buffer->offset += 4;
+        return (handler->boolean == NULL) || handler->boolean(parser->context, true);
+    }
+    /* string */
+    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '\"'))
+    {
+        return sax_parse_string(parser, false);
+    }
+    /* number: parsed into an item on the stack, so no node is allocated */
+    if (can_access_at_index(input_buffer, 0) && ((buffer_at_offset(input_buffer)[0] == '-') || ((buffer_at_offset(input_buffer)[0] >= '0') && (buffer_at_offset(input_buffer)[0] <= '9'))))
+    {
+        cJSON number;
+        memset(&number, '\0', sizeof(number));
+        if (!parse_number(&number, input_buffer))
+        {
+            return false;
+        }
+        return (handler->number == NULL) || handler->number(parser->context, number.valuedouble);
+    }
+    /* array */
+    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '['))
+    {
+        return sax_parse_array(parser);
+    }
+    /* object */
+    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '{'))
+    {
+        return sax_parse_object(parser);
     }
 
-    /* Adding null character size due to require_null_terminated. */
-    buffer_length = strlen(value) + sizeof("");
-
-    return cJSON_ParseWithLengthOpts(value, buffer_length, return_parse_end, require_null_terminated);
+    return false;
 }
 
-/* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSaxWithLengthOpts(const char *value, size_t buffer_length, const cJSON_SaxHandler *handler, void *context, const char **return_parse_end, cJSON_bool require_null_terminated)
 {
-    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
-    cJSON *item = NULL;
+    sax_parser parser;
 
     /* reset error position */
     global_error.json = NULL;
     global_error.position = 0;
 
-    if (value == NULL || 0 == buffer_length)
-    {
-        goto fail;
-    }
-
-    buffer.content = (const unsigned char*)value;
-    buffer.length = buffer_length;
-    buffer.offset = 0;
-    buffer.hooks = global_hooks;
+    memset(&parser, '\0', sizeof(parser));
+    parser.buffer.content = (const unsigned char*)value;
+    parser.buffer.length = buffer_length;
+    parser.buffer.offset = 0;
+    parser.buffer.hooks = global_hooks;
+    parser.handler = handler;
+    parser.context = context;
 
-    item = cJSON_New_Item(&global_hooks);
-    if (item == NULL) /* memory fail */
+    if ((value == NULL) || (0 == buffer_length) || (handler == NULL))
     {
         goto fail;
     }
 
-    if (!parse_value(item, buffer_skip_whitespace(skip_utf8_bom(&buffer))))
+    buffer_skip_whitespace(skip_utf8_bom(&parser.buffer));
+    if (!sax_parse_value(&parser))
     {
-        /* parse failure. ep is set. */
         goto fail;
     }
 
     /* if we require null-terminated JSON without appended garbage, skip and then check for a null terminator */
     if (require_null_terminated)
     {
-        buffer_skip_whitespace(&buffer);
-        if ((buffer.offset >= buffer.length) || buffer_at_offset(&buffer)[0] != '\0')
+        buffer_skip_whitespace(&parser.buffer);
+        if ((parser.buffer.offset >= parser.buffer.length) || buffer_at_offset(&parser.buffer)[0] != '\0')
         {
             goto fail;
         }
     }
     if (return_parse_end)
     {
-        *return_parse_end = (const char*)buffer_at_offset(&buffer);
+        *return_parse_end = (const char*)buffer_at_offset(&parser.buffer);
     }
 
-    return item;
+    if (parser.scratch != NULL)
+    {
+        parser.buffer.hooks.deallocate(parser.scratch);
+    }
+
+    return true;
 
 fail:
-    if (item != NULL)
+    if (parser.scratch != NULL)
     {
-        cJSON_Delete(item);
+        parser.buffer.hooks.deallocate(parser.scratch);
     }
 
     if (value != NULL)
@@ -1198,13 +2165,13 @@ fail:
         local_error.json = (const unsigned char*)value;
         local_error.position = 0;
 
-        if (buffer.offset < buffer.length)
+        if (parser.buffer.offset < parser.buffer.length)
         {
-            local_error.position = buffer.offset;
+            local_error.position = parser.buffer.offset;
         }
-        else if (buffer.length > 0)
+        else if (parser.buffer.length > 0)
         {
-            local_error.position = buffer.length - 1;
+            local_error.position = parser.buffer.length - 1;
         }
 
         if (return_parse_end != NULL)
@@ -1215,18 +2182,22 @@ fail:
         global_error = local_error;
     }
 
-    return NULL;
+    return false;
 }
 
-/* Default options for cJSON_Parse */
-CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSax(const char *value, const cJSON_SaxHandler *handler, void *context)
 {
-    return cJSON_ParseWithOpts(value, 0, 0);
+    if (value == NULL)
+    {
+        return false;
+    }
+
+    return cJSON_ParseSaxWithLengthOpts(value, strlen(value) + sizeof(""), handler, context, 0, 0);
 }
 
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_length)
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSaxWithLength(const char *value, size_t buffer_length, const cJSON_SaxHandler *handler, void *context)
 {
-    return cJSON_ParseWithLengthOpts(value, buffer_length, 0, 0);
+    return cJSON_ParseSaxWithLengthOpts(value, buffer_length, handler, context, 0, 0);
 }
 
 #define cjson_min(a, b) (((a) < (b)) ? (a) : (b))
@@ -1311,7 +2282,7 @@ CJSON_PUBLIC(char *) cJSON_PrintUnformatted(const cJSON *item)
 
 CJSON_PUBLIC(char *) cJSON_PrintBuffered(const cJSON *item, int prebuffer, cJSON_bool fmt)
 {
-    printbuffer p = { 0, 0, 0, 0, 0, 0, { 0, 0, 0 } };
+    printbuffer p = { 0, 0, 0, 0, 0, 0, { 0, 0, 0, 0 } };
 
     if (prebuffer < 0)
     {
@@ -1342,7 +2313,7 @@ CJSON_PUBLIC(char *) cJSON_PrintBuffered(const cJSON *item, int prebuffer, cJSON
 
 CJSON_PUBLIC(cJSON_bool) cJSON_PrintPreallocated(cJSON *item, char *buffer, const int length, const cJSON_bool format)
 {
-    printbuffer p = { 0, 0, 0, 0, 0, 0, { 0, 0, 0 } };
+    printbuffer p = { 0, 0, 0, 0, 0, 0, { 0, 0, 0, 0 } };
 
     if ((length < 0) || (buffer == NULL))
     {
@@ -1580,7 +2551,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
@@ -1722,6 +2693,11 @@ static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_bu
         /* swap valuestring and string, because we parsed the name */
         current_item->string = current_item->valuestring;
         current_item->valuestring = NULL;
+        if (input_buffer->insitu)
+        {
+            /* the name lives in the input buffer, don't let cJSON_Delete free it */
+            current_item->type = cJSON_StringIsConst;
+        }
 
         if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != ':'))
         {
@@ -1735,6 +2711,10 @@ static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_bu
         {
             goto fail; /* failed to parse value */
         }
+        if (input_buffer->insitu)
+        {
+            current_item->type |= cJSON_StringIsConst;
+        }
         buffer_skip_whitespace(input_buffer);
     }
     while (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ','));
@@ -1760,7 +2740,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
@@ -1975,6 +2955,163 @@ CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const objec
     return get_object_item(object, string, true);
 }
 
+/* FNV-1a over the case-folded name, so that names equal for case_insensitive_strcmp hash alike */
+static unsigned long hash_key(const unsigned char *string)
+{
+    unsigned long hash = 2166136261UL;
+
+    for (; *string != '\0'; string++)
+    {
+        hash ^= (unsigned long)tolower(*string);
+        hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    return hash;
+}
+
+CJSON_PUBLIC(cJSON_Key) cJSON_MakeKey(const char *string)
+{
+    cJSON_Key key;
+
+    key.string = string;
+    key.hash = 0;
+    if (string != NULL)
+    {
+        key.hash = hash_key((const unsigned char*)string);
+    }
+
+    return key;
+}
+
+/* Open-addressing table of the members of one object, holding the first member for each name like get_object_item finds it */
+typedef struct
+{
+    unsigned long hash;
+    cJSON *item; /* NULL when the slot is empty */
+} object_index_slot;
+
+struct cJSON_ObjectIndex
+{
+    const cJSON *object;
+    object_index_slot *slots;
+    size_t slot_count; /* power of two, 0 until the first lookup */
+};
+
+CJSON_PUBLIC(cJSON_ObjectIndex *) cJSON_CreateObjectIndex(const cJSON *object)
+{
+    cJSON_ObjectIndex *index = NULL;
+
+    if (!cJSON_IsObject(object))
+    {
+        return NULL;
+    }
+
+    index = (cJSON_ObjectIndex*)global_hooks.allocate(sizeof(cJSON_ObjectIndex));
+    if (index == NULL)
+    {
+        return NULL;
+    }
+    index->object = object;
+    index->slots = NULL;
+    index->slot_count = 0;
+
+    return index;
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteObjectIndex(cJSON_ObjectIndex *index)
+{
+    if (index == NULL)
+    {
+        return;
+    }
+
+    if (index->slots != NULL)
+    {
+        global_hooks.deallocate(index->slots);
+    }
+    global_hooks.deallocate(index);
+}
+
+static cJSON_bool build_object_index(cJSON_ObjectIndex * const index)
+{
+    const cJSON *child = NULL;
+    size_t member_count = 0;
+    size_t slot_count = 8;
+
+    for (child = index->object->child; child != NULL; child = child->next)
+    {
+        member_count++;
+    }
+    /* keep the load factor at or below one half */
+    while (slot_count < (member_count * 2))
+    {
+        slot_count *= 2;
+    }
+
+    index->slots = (object_index_slot*)global_hooks.allocate(slot_count * sizeof(object_index_slot));
+    if (index->slots == NULL)
+    {
+        return false;
+    }
+    memset(index->slots, '\0', slot_count * sizeof(object_index_slot));
+    index->slot_count = slot_count;
+
+    for (child = index->object->child; child != NULL; child = child->next)
+    {
+        unsigned long hash = 0;
+        size_t slot = 0;
+
+        if (child->string == NULL)
+        {
+            continue;
+        }
+
+        hash = hash_key((const unsigned char*)child->string);
+        for (slot = hash & (slot_count - 1); index->slots[slot].item != NULL; slot = (slot + 1) & (slot_count - 1))
+        {
+            if ((index->slots[slot].hash == hash)
+                && (case_insensitive_strcmp((const unsigned char*)child->string, (const unsigned char*)index->slots[slot].item->string) == 0))
+            {
+                break; /* an earlier member has this name */
+            }
+        }
+        if (index->slots[slot].item == NULL)
+        {
+            index->slots[slot].hash = hash;
+            index->slots[slot].item = (cJSON*)child;
+        }
+    }
+
+    return true;
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_GetIndexedItem(cJSON_ObjectIndex * const index, const cJSON_Key * const key)
+{
+    size_t slot = 0;
+
+    if ((index == NULL) || (key == NULL) || (key->string == NULL))
+    {
+        return NULL;
+    }
+
+    if ((index->slot_count == 0) && !build_object_index(index))
+    {
+        /* out of memory, the list still works */
+        return get_object_item(index->object, key->string, false);
+    }
+
+    for (slot = key->hash & (index->slot_count - 1); index->slots[slot].item != NULL; slot = (slot + 1) & (index->slot_count - 1))
+    {
+        if ((index->slots[slot].hash == key->hash)
+            && (case_insensitive_strcmp((const unsigned char*)key->string, (const unsigned char*)index->slots[slot].item->string) == 0))
+        {
+            return index->slots[slot].item;
+        }
+    }
+
+    return NULL;
+}
+
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string)
 {
     return cJSON_GetObjectItem(object, string) ? 1 : 0;
@@ -145,6 +145,8 @@ typedef int cJSON_bool;
 
 /* returns the version of cJSON as a string */
 CJSON_PUBLIC(const char*) cJSON_Version(void);
+/* Name of the string and whitespace scanning kernel picked for this CPU: "avx2", "sse2" or "scalar". */
+CJSON_PUBLIC(const char*) cJSON_ScanKernel(void);
 
 /* Supply malloc, realloc and free functions to cJSON */
 CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks);
@@ -158,6 +160,49 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_len
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated);
 
+/* In-situ parsing: strings and names are unescaped inside value, which must be writable, and the tree points into it
+ * instead of copying them. value must outlive the tree and is modified even when parsing fails. The tree is released
+ * with cJSON_Delete as usual; its strings are flagged cJSON_IsReference/cJSON_StringIsConst so they are not freed. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSitu(char *value, size_t buffer_length);
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituOpts(char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated);
+
+/* Arena allocation: an arena hands out memory from large blocks and releases it all in one call.
+ * Trees parsed into an arena must be released with cJSON_ResetArena or cJSON_DeleteArena, never with cJSON_Delete.
+ * block_size of 0 selects the default block size. */
+typedef struct cJSON_Arena cJSON_Arena;
+CJSON_PUBLIC(cJSON_Arena *) cJSON_CreateArena(size_t block_size);
+/* Release everything allocated from the arena, keeping the arena itself usable. */
+CJSON_PUBLIC(void) cJSON_ResetArena(cJSON_Arena *arena);
+CJSON_PUBLIC(void) cJSON_DeleteArena(cJSON_Arena *arena);
+/* Route all cJSON allocations to the arena through cJSON_InitHooks; pass NULL to restore malloc/free. */
+CJSON_PUBLIC(void) cJSON_InitArenaHooks(cJSON_Arena *arena);
+/* Parse into an arena; the global hooks are untouched, so other threads may keep using cJSON meanwhile. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseInArena(cJSON_Arena *arena, const char *value);
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthInArena(cJSON_Arena *arena, const char *value, size_t buffer_length);
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituInArena(cJSON_Arena *arena, char *value, size_t buffer_length);
+
+/* Event-driven parsing: instead of building a tree, report every value to a handler and allocate no cJSON nodes.
+ * Strings and keys come with their length and are not necessarily zero terminated. A literal without escape
+ * sequences points straight into the input; an escaped one is unescaped into a scratch buffer that is only valid
+ * during the callback. Callbacks may be NULL; the input is still checked against the same grammar as cJSON_Parse.
+ * A callback returning false stops the parse, which then fails. */
+typedef struct cJSON_SaxHandler
+{
+    cJSON_bool (*start_object)(void *context);
+    cJSON_bool (*end_object)(void *context);
+    cJSON_bool (*start_array)(void *context);
+    cJSON_bool (*end_array)(void *context);
+    cJSON_bool (*key)(void *context, const char *key, size_t length);
+    cJSON_bool (*string)(void *context, const char *value, size_t length);
+    cJSON_bool (*number)(void *context, double value);
+    cJSON_bool (*boolean)(void *context, cJSON_bool value);
+    cJSON_bool (*null)(void *context);
+} cJSON_SaxHandler;
+/* These return 1 when the whole value was parsed and 0 on error, with cJSON_GetErrorPtr set like for cJSON_Parse. */
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSax(const char *value, const cJSON_SaxHandler *handler, void *context);
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSaxWithLength(const char *value, size_t buffer_length, const cJSON_SaxHandler *handler, void *context);
+CJSON_PUBLIC(cJSON_bool) cJSON_ParseSaxWithLengthOpts(const char *value, size_t buffer_length, const cJSON_SaxHandler *handler, void *context, const char **return_parse_end, cJSON_bool require_null_terminated);
+
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. */
@@ -178,6 +223,21 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int index);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const object, const char * const string);
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string);
+
+/* Prehashed member name for cJSON_GetIndexedItem, hashed once for lookups in any number of indexes.
+ * string is not copied and must outlive the key. */
+typedef struct cJSON_Key
+{
+    const char *string;
+    unsigned long hash; /* of the case-folded name */
+} cJSON_Key;
+CJSON_PUBLIC(cJSON_Key) cJSON_MakeKey(const char *string);
+/* Hash index over the members of one large object, built on the first lookup. Lookups match cJSON_GetObjectItem.
+ * The index does not follow changes to the object; delete and recreate it after adding or removing members. */
+typedef struct cJSON_ObjectIndex cJSON_ObjectIndex;
+CJSON_PUBLIC(cJSON_ObjectIndex *) cJSON_CreateObjectIndex(const cJSON *object);
+CJSON_PUBLIC(void) cJSON_DeleteObjectIndex(cJSON_ObjectIndex *index);
+CJSON_PUBLIC(cJSON *) cJSON_GetIndexedItem(cJSON_ObjectIndex * const index, const cJSON_Key * const key);
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 CJSON_PUBLIC(const char *) cJSON_GetErrorPtr(void);
 
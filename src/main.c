@@ -1,9 +1,17 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cJSON.h"
+#include "payload.h"
+#include "server_list.h"
+#include "transfer.h"
 #include <curl/curl.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Constants */
@@ -11,23 +19,141 @@
 #define UPLOAD_SIZE_MB 30
 #define LOCATION_API_URL "http://ip-api.com/json/"
 #define LOCATION_API_TIMEOUT_SEC 10
-#define DOWNLOAD_PATH "/speedtest/random4000x4000.jpg"
+#define LOCATION_ARENA_BLOCK_SIZE 4096
+#define DOWNLOAD_PATH_FORMAT "/speedtest/random%dx%d.jpg"
 #define UPLOAD_PATH "/speedtest/upload.php"
 #define MAX_URL_LENGTH 256
+#define SERVER_LIST_PATH "speedtest_server_list.json"
+#define PROBE_TIMEOUT_SEC 5
+#define PROBE_DEFAULT_CONCURRENCY 16
+#define LATENCY_DEFAULT_CANDIDATES 5
+#define LATENCY_DEFAULT_ROUNDS 5
+#define DEFAULT_STREAMS 1
+#define MAX_STREAMS 64
+#define WARMUP_DEFAULT_SEC 2.0
+#define ADAPTIVE_MIN_DURATION_SEC 4.0
+#define ADAPTIVE_WINDOW_SEC 0.5  /* Length of one throughput sample */
+#define ADAPTIVE_WINDOWS 4       /* Samples that must agree to stop early */
+#define ADAPTIVE_TOLERANCE 0.05  /* Max deviation of a sample from their mean */
+#define SERIES_INTERVAL_SEC 0.1
+
+/* Long-only command line options */
+enum {
+    OPT_PROBE_CONCURRENCY = 256,
+    OPT_RANK_LATENCY,
+    OPT_LATENCY_CANDIDATES,
+    OPT_LATENCY_ROUNDS,
+    OPT_COUNTRY,
+    OPT_CITY,
+    OPT_STREAMS,
+    OPT_WARMUP,
+    OPT_ADAPTIVE,
+    OPT_ESCALATE,
+    OPT_MIN_DURATION,
+    OPT_MAX_DURATION,
+    OPT_SERIES,
+    OPT_DUPLEX
+};
+
+/*
+ * Cumulative bytes of all streams of a test every SERIES_INTERVAL_SEC after
+ * its first byte. The ring is sized for the longest test up front, so taking
+ * a sample never allocates; a longer test would keep the latest samples.
+ */
+struct throughput_series {
+    size_t *bytes;
+    int capacity;
+    int count; /* Samples taken; the last min(count, capacity) are kept */
+};
+
+/* Distribution of the series' per-interval rates, in Mbps */
+struct interval_stats {
+    int count; /* Intervals summarized, 0 if none */
+    double min;
+    double p10;
+    double p50;
+    double p90;
+    double max;
+    double stddev;
+};
+
+/* Outcome of one download or upload test */
+struct test_result {
+    double speed_mbps;   /* Steady-state rate, or average if no steady state */
+    double average_mbps; /* Over the whole transfer; -1.0 on failure */
+    struct throughput_series series;
+    struct interval_stats stats;
+};
+
+/*
+ * Byte arrival times of one speed test, shared by its streams. Throughput
+ * counts only from the end of the warm-up, which starts at the first byte,
+ * so connection setup and TCP slow start don't drag the result down.
+ */
+struct throughput_meter {
+    double warmup;       /* Seconds after the first byte that don't count */
+    double first_byte;   /* Arrival of the first byte, 0 until then */
+    double steady_start; /* First arrival after the warm-up, 0 until then */
+    double last_byte;
+    size_t total_bytes;  /* Of all streams */
+    struct throughput_series *series; /* Sampled when set */
+
+    /*
+     * In adaptive mode the steady window is sampled every
+     * ADAPTIVE_WINDOW_SEC, and the test converges once the last
+     * ADAPTIVE_WINDOWS samples agree and min_duration has passed
+     */
+    int adaptive;
+    double min_duration;
+    double window_start;
+    size_t window_bytes; /* Bytes of all streams in the current sample */
+    double window_rates[ADAPTIVE_WINDOWS];
+    int window_count;    /* Samples taken so far */
+    int converged;       /* Set once this test's rate converged */
+    int *stop;           /* Set once the streams should stop; shared by paired tests */
+};
 
 struct transfer_data {
-    size_t total_bytes;  /* Accumulated bytes for download or upload */
-    char *upload_buffer; /* Buffer for upload data */
-    size_t upload_size;  /* Total size of upload buffer */
-    size_t upload_sent;  /* Bytes already sent */
+    size_t total_bytes;   /* Accumulated bytes for download or upload */
+    size_t steady_bytes;  /* Part of total_bytes after the warm-up */
+    struct throughput_meter *meter;
+    struct payload_generator payload; /* Source of the upload body */
+    size_t upload_size;   /* Total bytes to upload, 0 for no limit */
+    size_t upload_sent;   /* Bytes already sent */
 };
 
+struct stream_run;
+
+/* One connection of a speed test; a test runs one or more side by side */
+struct stream {
+    CURL *curl;
+    CURLcode result;
+    struct transfer_data data;
+    int size_step;         /* Index in DOWNLOAD_SIZES of the image being fetched */
+    double finished_time;  /* Seconds of the transfers before the current one */
+    struct stream_run *run; /* While the stream runs */
+};
+
+/*
+ * Called when a stream's transfer completes without error. Returns 1 after
+ * setting up another transfer on the same handle, 0 to let the stream end.
+ */
+typedef int (*stream_restart_fn)(struct stream *stream, void *context);
+
 /* upload/download progress */
 struct progress_data {
     curl_off_t last_bytes_shown;
     int is_upload;
+    const struct stream *streams; /* Progress is summed over these when set */
+    int stream_count;
+    const struct throughput_meter *meter; /* Transfers stop once it says so */
+    int silent; /* Only watch the meter, for tests sharing the terminal */
 };
 
+/* Edge lengths of the speedtest images, smallest first */
+static const int DOWNLOAD_SIZES[] = {350, 500, 750, 1000, 1500, 2000, 2500, 3000, 3500, 4000};
+#define DOWNLOAD_SIZE_COUNT ((int)(sizeof(DOWNLOAD_SIZES) / sizeof(DOWNLOAD_SIZES[0])))
+
 /* Geolocation api response */
 struct response_data {
     char *buffer;
@@ -39,12 +165,226 @@ struct location {
     char *city;
 };
 
+/* How the download and upload tests run */
+struct test_options {
+    int stream_count;    /* Parallel connections */
+    double warmup;       /* Seconds of each test left out of the steady-state rate */
+    int adaptive;        /* Stop a test once its rate converges */
+    int escalate;        /* Fetch ever larger images until min_duration */
+    double min_duration; /* Seconds an adaptive or escalating test runs at least */
+    double max_duration; /* Seconds any test runs at most */
+    struct transfer_engine *engine; /* Runs the transfers */
+};
+
+/* How find_best_server picks a server within a priority tier */
+struct selection_options {
+    int max_concurrency;    /* Max reachability probes in flight */
+    int rank_by_latency;    /* Rank by median latency instead of first answer */
+    int latency_candidates; /* Servers per tier timed in latency-ranked mode */
+    int latency_rounds;     /* Round trips measured per timed server */
+    int location_filter;    /* Only consider servers at the given location */
+    struct transfer_engine *engine; /* Runs the probes */
+};
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+ * Allocate the ring for a test of at most max_duration seconds.
+ * Returns 0 on success, -1 if no memory.
+ */
+static int series_init(struct throughput_series *series, double max_duration) {
+    series->capacity = (int)(max_duration / SERIES_INTERVAL_SEC) + 2;
+    series->count = 0;
+    series->bytes = malloc(series->capacity * sizeof(size_t));
+    return series->bytes ? 0 : -1;
+}
+
+static void series_free(struct throughput_series *series) {
+    free(series->bytes);
+    series->bytes = NULL;
+    series->capacity = 0;
+    series->count = 0;
+}
+
+/* Take the samples due by now, with the byte count they all share */
+static void series_record(struct throughput_series *series, double origin, double now,
+                          size_t total_bytes) {
+    while (origin + (series->count + 1) * SERIES_INTERVAL_SEC <= now) {
+        series->bytes[series->count % series->capacity] = total_bytes;
+        series->count++;
+    }
+}
+
+/*
+ * Append a test's samples to a CSV file as time, bytes so far and interval
+ * rate. Once the ring has wrapped, the oldest kept sample has lost the one
+ * before it, so its rate is left empty.
+ */
+static void write_series(FILE *file, const char *test,
+                         const struct throughput_series *series) {
+    int first = series->count > series->capacity ? series->count - series->capacity : 0;
+    int i;
+
+    for (i = first; i < series->count; i++) {
+        size_t bytes = series->bytes[i % series->capacity];
+        fprintf(file, "%s,%.1f,%lu,", test, (i + 1) * SERIES_INTERVAL_SEC,
+                (unsigned long)bytes);
+        if (i == 0 || i > first) {
+            size_t previous = i == 0 ? 0 : series->bytes[(i - 1) % series->capacity];
+            fprintf(file, "%.3f",
+                    (bytes - previous) * 8.0 / SERIES_INTERVAL_SEC / 1000000.0);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Percentile of sorted values, interpolating between the nearest ranks */
+static double percentile(const double *sorted, int count, double fraction) {
+    double rank = fraction * (count - 1);
+    int lower = (int)rank;
+    if (lower + 1 >= count) {
+        return sorted[count - 1];
+    }
+    return sorted[lower] + (rank - lower) * (sorted[lower + 1] - sorted[lower]);
+}
+
+/*
+ * Summarize the rates of the kept intervals that end after skip seconds, or
+ * of all of them if none does. Returns 0 on success, -1 if there are none or
+ * no memory.
+ */
+static int series_stats(const struct throughput_series *series, double skip,
+                        struct interval_stats *stats) {
+    /* A rate needs the sample before it, which the ring may have dropped */
+    int first = series->count > series->capacity ? series->count - series->capacity + 1 : 0;
+    int start = first;
+    int count = 0;
+    double sum = 0;
+    double squares = 0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    while (start < series->count && (start + 1) * SERIES_INTERVAL_SEC <= skip + 1e-9) {
+        start++;
+    }
+    if (start == series->count) {
+        start = first;
+    }
+    if (start == series->count) {
+        return -1;
+    }
+
+    double *rates = malloc((series->count - start) * sizeof(double));
+    if (!rates) {
+        return -1;
+    }
+    for (i = start; i < series->count; i++) {
+        size_t previous = i == 0 ? 0 : series->bytes[(i - 1) % series->capacity];
+        double rate = (series->bytes[i % series->capacity] - previous) * 8.0 /
+                      SERIES_INTERVAL_SEC / 1000000.0;
+        rates[count++] = rate;
+        sum += rate;
+    }
+    qsort(rates, count, sizeof(double), compare_doubles);
+
+    double mean = sum / count;
+    for (i = 0; i < count; i++) {
+        squares += (rates[i] - mean) * (rates[i] - mean);
+    }
+    stats->count = count;
+    stats->min = rates[0];
+    stats->p10 = percentile(rates, count, 0.10);
+    stats->p50 = percentile(rates, count, 0.50);
+    stats->p90 = percentile(rates, count, 0.90);
+    stats->max = rates[count - 1];
+    stats->stddev = sqrt(squares / count);
+    free(rates);
+    return 0;
+}
+
+/*
+ * Close the current throughput sample and check whether the last
+ * ADAPTIVE_WINDOWS samples all lie within ADAPTIVE_TOLERANCE of their mean
+ */
+static void meter_sample(struct throughput_meter *meter, double now) {
+    meter->window_rates[meter->window_count % ADAPTIVE_WINDOWS] =
+        meter->window_bytes / (now - meter->window_start);
+    meter->window_count++;
+    meter->window_start = now;
+    meter->window_bytes = 0;
+
+    if (meter->window_count < ADAPTIVE_WINDOWS ||
+        now - meter->first_byte < meter->min_duration) {
+        return;
+    }
+
+    double mean = 0;
+    int i;
+    for (i = 0; i < ADAPTIVE_WINDOWS; i++) {
+        mean += meter->window_rates[i] / ADAPTIVE_WINDOWS;
+    }
+    for (i = 0; i < ADAPTIVE_WINDOWS; i++) {
+        double deviation = meter->window_rates[i] - mean;
+        if (deviation > mean * ADAPTIVE_TOLERANCE || -deviation > mean * ADAPTIVE_TOLERANCE) {
+            return;
+        }
+    }
+    meter->converged = 1;
+    *meter->stop = 1;
+}
+
+/*
+ * Timestamp bytes as a transfer callback sees them. A callback's bytes
+ * arrived since the previous one, so the call that ends the warm-up only
+ * marks the start of the steady window and the following ones count.
+ */
+static void meter_record(struct transfer_data *data, size_t bytes) {
+    struct throughput_meter *meter = data->meter;
+    if (!meter || bytes == 0) {
+        return;
+    }
+
+    double now = monotonic_seconds();
+    if (meter->first_byte == 0) {
+        meter->first_byte = now;
+    }
+    /* These bytes arrived since the previous call, so after any sample due */
+    if (meter->series) {
+        series_record(meter->series, meter->first_byte, now, meter->total_bytes);
+    }
+    meter->total_bytes += bytes;
+    if (meter->steady_start > 0) {
+        data->steady_bytes += bytes;
+        meter->window_bytes += bytes;
+    } else if (now - meter->first_byte >= meter->warmup) {
+        meter->steady_start = now;
+        meter->window_start = now;
+    }
+    meter->last_byte = now;
+
+    if (meter->adaptive && meter->steady_start > 0 &&
+        now - meter->window_start >= ADAPTIVE_WINDOW_SEC) {
+        meter_sample(meter, now);
+    }
+}
+
 static size_t download_write_callback(char *buffer, size_t size, size_t nitems,
                                       void *outstream) {
     (void)buffer;
     struct transfer_data *data = (struct transfer_data *)outstream;
     size_t realsize = size * nitems;
     data->total_bytes += realsize;
+    meter_record(data, realsize);
     return realsize;
 }
 
@@ -72,19 +412,27 @@ static size_t api_response_callback(char *buffer, size_t size, size_t nitems,
     return realsize;
 }
 
+/*
+ * Produce the upload body on demand, generating random bytes straight into
+ * curl's upload buffer so nothing along the path can compress them
+ */
 static size_t upload_read_callback(char *buffer, size_t size, size_t nitems,
                                    void *instream) {
     struct transfer_data *data = (struct transfer_data *)instream;
-    size_t max_bytes = size * nitems;
-    size_t remaining = data->upload_size - data->upload_sent;
-    size_t to_send = (max_bytes < remaining) ? max_bytes : remaining;
+    size_t to_send = size * nitems;
 
-    if (to_send > 0 && data->upload_buffer) {
-        memcpy(buffer, data->upload_buffer + data->upload_sent, to_send);
-        data->upload_sent += to_send;
-        data->total_bytes += to_send;
+    if (data->upload_size > 0) {
+        size_t remaining = data->upload_size - data->upload_sent;
+        if (to_send > remaining) {
+            to_send = remaining;
+        }
     }
 
+    payload_fill(&data->payload, buffer, to_send);
+    data->upload_sent += to_send;
+    data->total_bytes += to_send;
+    meter_record(data, to_send);
+
     return to_send;
 }
 
@@ -100,6 +448,14 @@ static int transfer_progress_callback(void *clientp, curl_off_t dltotal,
         return 0;
     }
 
+    /* Abort the transfer; the streams' bytes so far make the result */
+    if (progress->meter && *progress->meter->stop) {
+        return 1;
+    }
+    if (progress->silent) {
+        return 0;
+    }
+
     /* Determine if this is upload or download */
     if (ultotal > 0 || ulnow > 0) {
         progress->is_upload = 1;
@@ -109,6 +465,18 @@ static int transfer_progress_callback(void *clientp, curl_off_t dltotal,
         current_bytes = dlnow;
     }
 
+    /* Parallel streams transfer the same resource, so show their sum */
+    if (progress->streams) {
+        int i;
+        current_bytes = 0;
+        for (i = 0; i < progress->stream_count; i++) {
+            current_bytes += (curl_off_t)progress->streams[i].data.total_bytes;
+        }
+        ulnow = dlnow = current_bytes;
+        ultotal *= progress->stream_count;
+        dltotal *= progress->stream_count;
+    }
+
     /* Show progress every 1MB */
     if (current_bytes >= progress->last_bytes_shown + one_mb) {
         if (progress->is_upload) {
@@ -141,375 +509,875 @@ static int transfer_progress_callback(void *clientp, curl_off_t dltotal,
     return 0;
 }
 
-/* Read and parse JSON file into cJSON object. Returns NULL on error. */
-cJSON *read_json_file(const char *filename) {
-    FILE *stream = fopen(filename, "r");
-    if (!stream) {
-        fprintf(stderr, "Error opening file: %s\n", filename);
+/* Configure a HEAD (no body) request used to check server reachability */
+static CURL *create_probe_handle(const char *host) {
+    CURL *curl = curl_easy_init();
+    if (!curl) {
         return NULL;
     }
 
-    /* Get file size */
-    fseek(stream, 0, SEEK_END);
-    long size = ftell(stream);
-    fseek(stream, 0, SEEK_SET);
+    char url[MAX_URL_LENGTH];
+    strcpy(url, "http://");
+    strcat(url, host);
+    strcat(url, "/");
 
-    if (size <= 0) {
-        fprintf(stderr, "Error: Invalid file size: %s\n", filename);
-        fclose(stream);
-        return NULL;
-    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L); /* HEAD request */
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)PROBE_TIMEOUT_SEC);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+    return curl;
+}
 
-    /* Read into buffer */
-    char *buffer = malloc(size + 1);
-    if (!buffer) {
-        fprintf(stderr, "Error: Failed to allocate memory for file: %s\n", filename);
-        fclose(stream);
-        return NULL;
+/* Returns 1 if a finished probe got an acceptable response, 0 otherwise. */
+static int probe_succeeded(CURL *curl, CURLcode res) {
+    long response_code = 0;
+
+    if (res != CURLE_OK) {
+        return 0;
     }
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    return response_code >= 200 && response_code < 500;
+}
 
-    size_t bytes_read = fread(buffer, 1, size, stream);
-    if (bytes_read != (size_t)size) {
-        fprintf(stderr, "Error: Failed to read file completely: %s\n", filename);
-        free(buffer);
-        fclose(stream);
-        return NULL;
+struct probe_pool;
+
+/* Done context of one probe */
+struct probe_slot {
+    struct probe_pool *pool;
+    int index; /* In hosts */
+};
+
+/* Reachability probes of one tier, with hosts started in order as slots free up */
+struct probe_pool {
+    struct transfer_engine *engine;
+    const char *const *hosts;
+    int count;
+    int max_concurrency;
+    CURL **handles;  /* In-flight handles by host index */
+    struct probe_slot *slots;
+    int next;
+    int in_flight;
+    int *found;
+    int found_count;
+    int want;
+};
+
+static void probe_done(CURL *curl, CURLcode result, void *context);
+
+/* Top up the pool of in-flight probes */
+static void probe_fill(struct probe_pool *pool) {
+    while (pool->next < pool->count && pool->in_flight < pool->max_concurrency) {
+        int index = pool->next++;
+        CURL *curl = create_probe_handle(pool->hosts[index]);
+        if (!curl) {
+            continue;
+        }
+        pool->slots[index].pool = pool;
+        pool->slots[index].index = index;
+        if (transfer_engine_add(pool->engine, curl, probe_done, &pool->slots[index]) != 0) {
+            curl_easy_cleanup(curl);
+            continue;
+        }
+        pool->handles[index] = curl;
+        pool->in_flight++;
     }
+}
 
-    buffer[size] = '\0';
-    fclose(stream);
+static void probe_done(CURL *curl, CURLcode result, void *context) {
+    struct probe_slot *slot = context;
+    struct probe_pool *pool = slot->pool;
 
-    cJSON *json = cJSON_Parse(buffer);
-    if (!json) {
-        fprintf(stderr, "Parse error: %.100s\n", cJSON_GetErrorPtr());
-        free(buffer);
-        return NULL;
+    if (pool->found_count < pool->want && probe_succeeded(curl, result)) {
+        pool->found[pool->found_count++] = slot->index;
     }
-    free(buffer);
+    curl_easy_cleanup(curl);
+    pool->handles[slot->index] = NULL;
+    pool->in_flight--;
 
-    return json;
+    if (pool->found_count < pool->want) {
+        probe_fill(pool);
+    } else {
+        transfer_engine_stop(pool->engine);
+    }
 }
 
 /*
- * Test if server is reachable using HEAD (no body) request.
- * Returns 1 if reachable, 0 otherwise.
+ * Probe hosts concurrently, keeping at most max_concurrency requests in
+ * flight, until want hosts have answered. Indices of the responding hosts are
+ * stored in found in answer order. Returns the number found.
  */
-static int test_server_reachable(const char *host) {
-    CURL *curl = curl_easy_init();
-    int reachable = 0;
+static int probe_reachable(struct transfer_engine *engine, const char *const *hosts,
+                           int count, int max_concurrency, int *found, int want) {
+    struct probe_pool pool;
+    int i;
 
-    if (!curl) {
+    if (count <= 0 || want <= 0) {
         return 0;
     }
+    if (max_concurrency <= 0 || max_concurrency > count) {
+        max_concurrency = count;
+    }
 
-    char url[MAX_URL_LENGTH];
-    strcpy(url, "http://");
-    strcat(url, host);
-    strcat(url, "/");
+    memset(&pool, 0, sizeof(pool));
+    pool.engine = engine;
+    pool.hosts = hosts;
+    pool.count = count;
+    pool.max_concurrency = max_concurrency;
+    pool.found = found;
+    pool.want = want;
+    pool.handles = calloc(count, sizeof(CURL *));
+    pool.slots = malloc(count * sizeof(struct probe_slot));
+    if (!pool.handles || !pool.slots) {
+        free(pool.handles);
+        free(pool.slots);
+        return 0;
+    }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L); /* HEAD request */
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+    probe_fill(&pool);
+    transfer_engine_run(engine);
 
-    CURLcode res = curl_easy_perform(curl);
-    if (res == CURLE_OK) {
-        long response_code;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-        if (response_code >= 200 && response_code < 500) {
-            reachable = 1;
+    /* Abandon probes still in flight once enough hosts have answered */
+    for (i = 0; i < pool.next; i++) {
+        if (pool.handles[i]) {
+            transfer_engine_remove(engine, pool.handles[i]);
+            curl_easy_cleanup(pool.handles[i]);
         }
     }
 
-    curl_easy_cleanup(curl);
-    return reachable;
+    free(pool.handles);
+    free(pool.slots);
+    return pool.found_count;
 }
 
-/* Find best server by location */
-static cJSON *find_best_server(cJSON *json_array, const char *user_country,
-                               const char *user_city) {
-    if (!json_array || !cJSON_IsArray(json_array)) {
-        return NULL;
+/* Round trips measured to one host */
+struct latency_host {
+    double *samples; /* rounds slots, in milliseconds */
+    int sample_count;
+};
+
+static void latency_done(CURL *curl, CURLcode result, void *context) {
+    struct latency_host *host = context;
+
+    if (probe_succeeded(curl, result)) {
+        double connect_time = 0.0;
+        double starttransfer_time = 0.0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer_time);
+        host->samples[host->sample_count++] = (starttransfer_time - connect_time) * 1000.0;
     }
+}
 
-    int count = cJSON_GetArraySize(json_array);
+/*
+ * Measure request round-trip time to each host over several rounds and store
+ * the median in milliseconds, or -1.0 if the host never answered. Each host
+ * keeps its handle over the rounds, so rounds after the first reuse the
+ * connection.
+ * A sample is CURLINFO_STARTTRANSFER_TIME - CURLINFO_CONNECT_TIME: one request
+ * round trip including server think time, without DNS or the TCP handshake.
+ */
+static void measure_latency(struct transfer_engine *engine, const char *const *hosts,
+                            int count, int rounds, double *medians) {
     int i;
-    cJSON *server;
-    const char *host;
-    const char *country;
-    const char *city;
+    int round;
 
-    /* Priority 1: test all city+country matches */
-    if (user_city && user_country) {
+    for (i = 0; i < count; i++) {
+        medians[i] = -1.0;
+    }
+    if (count <= 0 || rounds <= 0) {
+        return;
+    }
+
+    CURL **handles = calloc(count, sizeof(CURL *));
+    struct latency_host *timed = calloc(count, sizeof(struct latency_host));
+    double *samples = malloc((size_t)count * rounds * sizeof(double));
+    if (!handles || !timed || !samples) {
+        goto cleanup;
+    }
+
+    for (i = 0; i < count; i++) {
+        handles[i] = create_probe_handle(hosts[i]);
+        timed[i].samples = &samples[i * rounds];
+    }
+
+    for (round = 0; round < rounds; round++) {
         for (i = 0; i < count; i++) {
-            server = cJSON_GetArrayItem(json_array, i);
-            if (!server || !cJSON_IsObject(server)) {
-                continue;
+            /* Hosts that failed the first round are not worth waiting for again */
+            if (handles[i] && (round == 0 || timed[i].sample_count > 0)) {
+                transfer_engine_add(engine, handles[i], latency_done, &timed[i]);
             }
+        }
+        if (transfer_engine_run(engine) != 0) {
+            goto cleanup;
+        }
+    }
 
-            host = cJSON_GetStringValue(cJSON_GetObjectItem(server, "host"));
-            country = cJSON_GetStringValue(cJSON_GetObjectItem(server, "country"));
-            city = cJSON_GetStringValue(cJSON_GetObjectItem(server, "city"));
+    for (i = 0; i < count; i++) {
+        int n = timed[i].sample_count;
+        if (n > 0) {
+            double *host_samples = timed[i].samples;
+            qsort(host_samples, n, sizeof(double), compare_doubles);
+            medians[i] = (n % 2) ? host_samples[n / 2]
+                                 : (host_samples[n / 2 - 1] + host_samples[n / 2]) / 2.0;
+        }
+    }
 
-            if (!host || !city || !country) {
-                continue;
+cleanup:
+    if (handles) {
+        for (i = 0; i < count; i++) {
+            if (handles[i]) {
+                transfer_engine_remove(engine, handles[i]);
+                curl_easy_cleanup(handles[i]);
             }
+        }
+    }
+    free(handles);
+    free(timed);
+    free(samples);
+}
 
-            if (strcmp(city, user_city) == 0 && strcmp(country, user_country) == 0) {
-                if (test_server_reachable(host)) {
-                    return server;
+/*
+ * Pick a server from one priority tier of candidates. By default the first
+ * server to answer wins. In latency-ranked mode the first latency_candidates
+ * servers to answer are timed over several rounds and the one with the lowest
+ * median round trip wins. Returns the server index, or -1 if no candidate
+ * answered.
+ */
+static int probe_tier(const int *candidates, const char **hosts, int count,
+                      const struct selection_options *options) {
+    int want = options->rank_by_latency ? options->latency_candidates : 1;
+    int *found = malloc((want > 0 ? want : 1) * sizeof(int));
+    int best = -1;
+
+    if (!found) {
+        return -1;
+    }
+
+    int found_count = probe_reachable(options->engine, hosts, count,
+                                      options->max_concurrency, found, want);
+    if (found_count > 0 && !options->rank_by_latency) {
+        best = candidates[found[0]];
+    } else if (found_count > 0) {
+        const char **ranked_hosts = malloc(found_count * sizeof(char *));
+        double *medians = malloc(found_count * sizeof(double));
+        if (ranked_hosts && medians) {
+            int i;
+            int best_index = -1;
+
+            for (i = 0; i < found_count; i++) {
+                ranked_hosts[i] = hosts[found[i]];
+            }
+            measure_latency(options->engine, ranked_hosts, found_count,
+                            options->latency_rounds, medians);
+
+            printf("Median latency over %d rounds:\n", options->latency_rounds);
+            for (i = 0; i < found_count; i++) {
+                if (medians[i] < 0.0) {
+                    printf("  %-40s unreachable\n", ranked_hosts[i]);
+                    continue;
+                }
+                printf("  %-40s %8.2f ms\n", ranked_hosts[i], medians[i]);
+                if (best_index < 0 || medians[i] < medians[best_index]) {
+                    best_index = i;
                 }
             }
+            /* Hosts answered the reachability probe, so fall back to the first */
+            best = candidates[found[best_index >= 0 ? best_index : 0]];
         }
+        free(ranked_hosts);
+        free(medians);
     }
 
-    /* Priority 2: test all country matches (only if no city+country worked) */
-    if (user_country) {
-        for (i = 0; i < count; i++) {
-            server = cJSON_GetArrayItem(json_array, i);
-            if (!server || !cJSON_IsObject(server)) {
-                continue;
-            }
+    free(found);
+    return best;
+}
 
-            host = cJSON_GetStringValue(cJSON_GetObjectItem(server, "host"));
-            country = cJSON_GetStringValue(cJSON_GetObjectItem(server, "country"));
-            city = cJSON_GetStringValue(cJSON_GetObjectItem(server, "city"));
+/*
+ * Find best server by location. Returns its index in the list, or -1.
+ * With options->location_filter set, only servers in the given country (and
+ * city) are considered instead of falling back to the rest of the world.
+ */
+static int find_best_server(const struct server_list *list, const char *user_country,
+                            const char *user_city,
+                            const struct selection_options *options) {
+    struct server_slice country_slice;
+    struct server_slice city_slice;
+    int i;
+    int tier;
+    int best = -1;
 
-            if (!host || !country || !city) {
-                continue;
-            }
+    if (list->count <= 0) {
+        return -1;
+    }
+
+    /* Candidates of each priority tier, in file order */
+    const int *tiers[3];
+    int tier_counts[3] = {0, 0, 0};
+    int *country_rest = malloc(list->count * sizeof(int));
+    int *others = malloc(list->count * sizeof(int));
+    const char **hosts = malloc(list->count * sizeof(char *));
+    if (!country_rest || !others || !hosts) {
+        goto cleanup;
+    }
+    tiers[0] = NULL;
+    tiers[1] = country_rest;
+    tiers[2] = others;
+
+    int has_country = user_country &&
+                      server_list_find_country(list, user_country, &country_slice);
+    int has_city = has_country && user_city &&
+                   server_list_find_city(list, user_country, user_city, &city_slice);
+
+    /* Priority 1: city+country matches */
+    if (has_city) {
+        tiers[0] = city_slice.indices;
+        tier_counts[0] = city_slice.count;
+    }
 
-            if (strcmp(country, user_country) != 0) {
-                continue;
+    /* Priority 2: other country matches */
+    if (has_country) {
+        for (i = 0; i < country_slice.count; i++) {
+            int index = country_slice.indices[i];
+            if (!has_city || list->city_group[index] != city_slice.group) {
+                country_rest[tier_counts[1]++] = index;
             }
+        }
+    }
 
-            /* Skip if it's a city+country match (already tested in priority 1) */
-            if (user_city && strcmp(city, user_city) == 0) {
-                continue;
+    /* Priority 3: any other server */
+    if (!options->location_filter) {
+        for (i = 0; i < list->count; i++) {
+            if (!has_country || list->country_group[i] != country_slice.group) {
+                others[tier_counts[2]++] = i;
             }
+        }
+    }
+
+    /* A city filter leaves only the city itself */
+    if (options->location_filter && user_city) {
+        tier_counts[1] = 0;
+    }
+
+    /* Each tier is only tested if no server of the previous one answered */
+    for (tier = 0; tier < 3 && best < 0; tier++) {
+        for (i = 0; i < tier_counts[tier]; i++) {
+            hosts[i] = list->servers[tiers[tier][i]].host;
+        }
+        best = probe_tier(tiers[tier], hosts, tier_counts[tier], options);
+    }
+
+cleanup:
+    free(country_rest);
+    free(others);
+    free(hosts);
+    return best;
+}
 
-            if (test_server_reachable(host)) {
-                return server;
+/* Streams of one test running on the engine */
+struct stream_run {
+    struct transfer_engine *engine;
+    stream_restart_fn restart; /* Offered each successful transfer, if set */
+    void *context;
+    int active;      /* Streams not finished yet */
+    double started;
+    double finished; /* When the last stream finished */
+};
+
+static void stream_done(CURL *curl, CURLcode result, void *context) {
+    struct stream *stream = context;
+    struct stream_run *run = stream->run;
+
+    stream->result = result;
+    /* Adding the handle again starts its next transfer on the same connection */
+    if (result == CURLE_OK && run->restart) {
+        double transfer_time = 0;
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &transfer_time);
+        if (run->restart(stream, run->context)) {
+            stream->finished_time += transfer_time;
+            stream->result = CURLE_FAILED_INIT;
+            if (transfer_engine_add(run->engine, curl, stream_done, stream) == 0) {
+                return;
             }
+            stream->result = CURLE_OUT_OF_MEMORY;
         }
     }
 
-    /* Priority 3: test any server (only if no country match worked) */
+    run->active--;
+    if (run->active == 0) {
+        run->finished = monotonic_seconds();
+    }
+}
+
+/*
+ * Start the prepared streams side by side on the run's engine; they finish
+ * while it runs, storing each result. Returns 0 on success, -1 on error.
+ */
+static int start_streams(struct stream_run *run, struct stream *streams, int count) {
+    int i;
+
+    run->active = 0;
+    run->started = monotonic_seconds();
     for (i = 0; i < count; i++) {
-        server = cJSON_GetArrayItem(json_array, i);
-        if (!server || !cJSON_IsObject(server)) {
-            continue;
+        streams[i].result = CURLE_FAILED_INIT;
+        streams[i].run = run;
+        if (transfer_engine_add(run->engine, streams[i].curl, stream_done, &streams[i]) != 0) {
+            return -1;
         }
+        run->active++;
+    }
+    return 0;
+}
 
-        host = cJSON_GetStringValue(cJSON_GetObjectItem(server, "host"));
-        country = cJSON_GetStringValue(cJSON_GetObjectItem(server, "country"));
-        city = cJSON_GetStringValue(cJSON_GetObjectItem(server, "city"));
+/*
+ * Turn the finished streams of a test into a speed in Mbps, printing a
+ * summary with the rate of each stream. The raw average runs over the shared
+ * time window; the steady-state rate over the part of it after the warm-up.
+ * Returns the steady-state rate, or the raw average if the test ended before
+ * the warm-up did. Streams that failed or got an error status don't count.
+ * Returns -1.0 if no stream counts.
+ */
+static double report_streams(const struct stream *streams, int count, double elapsed,
+                             const struct throughput_meter *meter, int is_upload,
+                             struct test_result *result) {
+    const char *done_verb = is_upload ? "Uploaded" : "Downloaded";
+    const char *noun = is_upload ? "uploaded" : "downloaded";
+    size_t total_bytes = 0;
+    size_t steady_bytes = 0;
+    int usable = 0;
+    int timed_out = 0;
+    int stopped = 0;
+    int i;
 
-        if (!host || !country || !city) {
+    for (i = 0; i < count; i++) {
+        long response_code = 0;
+        double stream_time = 0;
+        curl_easy_getinfo(streams[i].curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_easy_getinfo(streams[i].curl, CURLINFO_TOTAL_TIME, &stream_time);
+        stream_time += streams[i].finished_time;
+
+        /* Handle timeout: count the data transferred before the timeout */
+        if (streams[i].result == CURLE_OPERATION_TIMEDOUT) {
+            timed_out = 1;
+        } else if (streams[i].result == CURLE_ABORTED_BY_CALLBACK && *meter->stop) {
+            stopped = 1;
+        } else if (streams[i].result != CURLE_OK) {
+            fprintf(stderr, "%s failed: %s\n", is_upload ? "Upload" : "Download",
+                    curl_easy_strerror(streams[i].result));
             continue;
-        }
-
-        /* Skip if already tested as city+country or country match */
-        if (user_country && strcmp(country, user_country) == 0) {
+        } else if (response_code != 200) {
+            printf("Warning: Server returned error code %ld\n", response_code);
             continue;
         }
+        usable++;
+        total_bytes += streams[i].data.total_bytes;
+        steady_bytes += streams[i].data.steady_bytes;
+
+        if (count > 1 && stream_time > 0) {
+            printf("  Stream %d: %.2f MB, %.2f Mbps\n", i + 1,
+                   streams[i].data.total_bytes / (1024.0 * 1024.0),
+                   streams[i].data.total_bytes * 8.0 / stream_time / 1000000.0);
+        }
+    }
 
-        if (test_server_reachable(host)) {
-            return server;
+    if (usable == 0) {
+        return -1.0;
+    }
+    if (total_bytes == 0 || elapsed <= 0) {
+        if (timed_out) {
+            printf("Warning: Timeout reached but no data was %s\n", noun);
+        } else {
+            printf("Warning: No data %s or time is zero\n", noun);
         }
+        return -1.0;
     }
 
-    return NULL;
-}
+    double speed_bps = (total_bytes * 8.0) / elapsed;
+    result->average_mbps = speed_bps / 1000000.0;
+    double mb_transferred = total_bytes / (1024.0 * 1024.0);
+    printf("%s %.2f MB in %.2f seconds", done_verb, mb_transferred, elapsed);
+    if (count > 1) {
+        printf(" over %d streams", usable);
+    }
+    if (stopped) {
+        printf(meter->converged ? " (stopped once the rate converged)\n"
+                                : " (stopped once the paired test converged)\n");
+    } else {
+        printf(timed_out ? " (timeout reached)\n" : "\n");
+    }
 
-/* Test download speed and return speed in Mbps, or -1.0 on failure */
-double test_download_speed(const char *host) {
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        return -1.0;
+    double speed_mbps;
+    double steady_time = meter->last_byte - meter->steady_start;
+    if (meter->steady_start > 0 && steady_bytes > 0 && steady_time > 0) {
+        double steady_bps = (steady_bytes * 8.0) / steady_time;
+        printf("Average %.2f Mbps, steady state %.2f Mbps (after %.1f s warm-up)\n",
+               speed_bps / 1000000.0, steady_bps / 1000000.0, meter->warmup);
+        speed_mbps = steady_bps / 1000000.0;
+    } else {
+        printf("Average %.2f Mbps (ended within the %.1f s warm-up)\n",
+               speed_bps / 1000000.0, meter->warmup);
+        speed_mbps = speed_bps / 1000000.0;
     }
 
-    char url[MAX_URL_LENGTH];
+    /* Intervals span all streams, so only a fully usable test summarizes them */
+    if (meter->series && usable == count &&
+        series_stats(meter->series, meter->warmup, &result->stats) == 0) {
+        const struct interval_stats *stats = &result->stats;
+        printf("Per %d ms: min %.2f, p10 %.2f, median %.2f, p90 %.2f, max %.2f, "
+               "stddev %.2f Mbps\n", (int)(SERIES_INTERVAL_SEC * 1000),
+               stats->min, stats->p10, stats->p50, stats->p90, stats->max, stats->stddev);
+    }
+    return speed_mbps;
+}
+
+/* Write the URL of the speedtest image with the given edge length on host */
+static void download_url(char *url, const char *host, int size) {
+    char path[64];
+    sprintf(path, DOWNLOAD_PATH_FORMAT, size, size);
     strcpy(url, "http://");
     strcat(url, host);
-    strcat(url, DOWNLOAD_PATH);
+    strcat(url, path);
+}
 
-    struct transfer_data data;
-    data.total_bytes = 0;
-    data.upload_buffer = NULL;
-    data.upload_size = 0;
-    data.upload_sent = 0;
+/* Where escalating download streams go next, and until when */
+struct download_escalation {
+    const char *host;
+    const struct throughput_meter *meter;
+    double min_duration; /* Seconds after the first byte to keep fetching */
+    double deadline;     /* Monotonic time the test times out */
+};
 
+/*
+ * stream_restart_fn of an escalating download: fetch the next larger image,
+ * or the largest one again, until the test has run min_duration. Small
+ * images first keep slow links from timing out on the first object, and
+ * repeated fetches keep fast links busy long enough to measure. Each fetch
+ * gets the time left to the test's deadline.
+ */
+static int escalate_download(struct stream *stream, void *context) {
+    struct download_escalation *escalation = context;
+    const struct throughput_meter *meter = escalation->meter;
+    double now = monotonic_seconds();
+    long response_code = 0;
+    char url[MAX_URL_LENGTH];
+
+    curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code != 200 || *meter->stop || meter->first_byte == 0 ||
+        now - meter->first_byte >= escalation->min_duration ||
+        escalation->deadline - now < 0.001) {
+        return 0;
+    }
+
+    if (stream->size_step < DOWNLOAD_SIZE_COUNT - 1) {
+        stream->size_step++;
+    }
+    download_url(url, escalation->host, DOWNLOAD_SIZES[stream->size_step]);
+    curl_easy_setopt(stream->curl, CURLOPT_URL, url);
+    curl_easy_setopt(stream->curl, CURLOPT_TIMEOUT_MS,
+                     (long)((escalation->deadline - now) * 1000));
+    return 1;
+}
+
+/* One download or upload test: its streams and what watches them */
+struct speed_test {
+    int is_upload;
+    struct stream *streams;
+    int stream_count;
+    double max_duration;
     struct progress_data progress;
-    progress.last_bytes_shown = 0;
-    progress.is_upload = 0;
+    struct throughput_meter meter;
+    struct download_escalation escalation;
+    struct stream_run run;
+    struct test_result *result;
+};
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, download_write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, transfer_progress_callback);
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)SPEEDTEST_TIMEOUT_SEC);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+/*
+ * Set up a test's streams against host. A sustained test keeps transferring
+ * until max_duration, or until it converges in adaptive mode: the upload
+ * body has no size and the download fetches the largest image again and
+ * again. Returns 0 on success, -1 on error; either way the test must be
+ * released with speed_test_free.
+ */
+static int speed_test_prepare(struct speed_test *test, const char *host,
+                              const struct test_options *options, int is_upload,
+                              int sustained, struct test_result *result) {
+    int stream_count = options->stream_count;
+    int first_step = options->escalate ? 0 : DOWNLOAD_SIZE_COUNT - 1;
+    /* An adaptive upload runs until it converges or reaches max_duration */
+    size_t upload_size = options->adaptive || sustained ? 0 : UPLOAD_SIZE_MB * 1024 * 1024;
+    char url[MAX_URL_LENGTH];
+    int i;
 
-    printf("Testing download speed from %s...\n", host);
-    CURLcode res = curl_easy_perform(curl);
-    printf("\n");
+    memset(test, 0, sizeof(*test));
+    test->is_upload = is_upload;
+    test->stream_count = stream_count;
+    test->max_duration = options->max_duration;
+    test->result = result;
+    result->speed_mbps = -1.0;
+    result->average_mbps = -1.0;
+
+    if (is_upload) {
+        strcpy(url, "http://");
+        strcat(url, host);
+        strcat(url, UPLOAD_PATH);
+    } else {
+        download_url(url, host, DOWNLOAD_SIZES[first_step]);
+    }
 
-    double speed_mbps = -1.0;
-    double total_time;
-    long response_code;
+    test->streams = calloc(stream_count, sizeof(struct stream));
+    if (!test->streams) {
+        return -1;
+    }
 
-    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    test->progress.last_bytes_shown = 0;
+    test->progress.is_upload = is_upload;
+    test->progress.streams = stream_count > 1 ? test->streams : NULL;
+    test->progress.stream_count = stream_count;
+    test->progress.meter = &test->meter;
+
+    test->meter.warmup = options->warmup;
+    test->meter.adaptive = options->adaptive;
+    test->meter.min_duration = options->min_duration;
+    test->meter.stop = &test->meter.converged;
+
+    test->escalation.host = host;
+    test->escalation.meter = &test->meter;
+    test->escalation.min_duration = sustained ? options->max_duration : options->min_duration;
+
+    test->run.engine = options->engine;
+    if (!is_upload && (options->escalate || sustained)) {
+        test->run.restart = escalate_download;
+        test->run.context = &test->escalation;
+    }
 
-    /* Handle timeout: calculate speed from data transferred before timeout */
-    if (res == CURLE_OPERATION_TIMEDOUT) {
-        if (data.total_bytes > 0 && total_time > 0) {
-            double speed_bps = (data.total_bytes * 8.0) / total_time;
-            speed_mbps = speed_bps / 1000000.0;
-            double mb_downloaded = data.total_bytes / (1024.0 * 1024.0);
-            printf("Downloaded %.2f MB in %.2f seconds (timeout reached)\n",
-                   mb_downloaded, total_time);
-        } else {
-            printf("Warning: Timeout reached but no data was downloaded\n");
-        }
-    } else if (res == CURLE_OK) {
-        if (response_code == 200 && total_time > 0 && data.total_bytes > 0) {
-            double speed_bps = (data.total_bytes * 8.0) / total_time;
-            speed_mbps = speed_bps / 1000000.0;
-            double mb_downloaded = data.total_bytes / (1024.0 * 1024.0);
-            printf("Downloaded %.2f MB in %.2f seconds\n", mb_downloaded, total_time);
+    if (series_init(&result->series, options->max_duration) == 0) {
+        test->meter.series = &result->series;
+    }
+
+    for (i = 0; i < stream_count; i++) {
+        struct stream *stream = &test->streams[i];
+        CURL *curl = curl_easy_init();
+        if (!curl) {
+            return -1;
+        }
+        stream->curl = curl;
+        stream->data.meter = &test->meter;
+
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        if (is_upload) {
+            /* Each stream gets its own sequence, so no two bodies match either */
+            payload_seed(&stream->data.payload, ((uint64_t)time(NULL) << 8) + (uint64_t)i);
+            stream->data.upload_size = upload_size;
+
+            curl_easy_setopt(curl, CURLOPT_POST, 1L);
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_read_callback);
+            curl_easy_setopt(curl, CURLOPT_READDATA, &stream->data);
+            /* Without a size the body is sent chunked until the test stops it */
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                             upload_size > 0 ? (curl_off_t)upload_size : (curl_off_t)-1);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_response_callback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
         } else {
-            if (response_code != 200) {
-                printf("Warning: Server returned error code %ld\n", response_code);
-            } else {
-                printf("Warning: No data downloaded or time is zero\n");
-            }
+            stream->size_step = first_step;
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, download_write_callback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &stream->data);
         }
-    } else {
-        fprintf(stderr, "Download failed: %s\n", curl_easy_strerror(res));
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, transfer_progress_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &test->progress);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)(options->max_duration * 1000));
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
     }
+    return 0;
+}
 
-    curl_easy_cleanup(curl);
-    return speed_mbps;
+/* Start a prepared test on its engine. Returns 0 on success, -1 on error. */
+static int speed_test_start(struct speed_test *test) {
+    test->escalation.deadline = monotonic_seconds() + test->max_duration;
+    return start_streams(&test->run, test->streams, test->stream_count);
 }
 
-/* Test upload speed and return speed in Mbps, or -1.0 on failure */
-double test_upload_speed(const char *host) {
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        return -1.0;
-    }
+/*
+ * Take a started test's streams off the engine and, unless status reports
+ * that the engine failed, report its result. The elapsed time runs from the
+ * start to the end of its last stream.
+ */
+static void speed_test_finish(struct speed_test *test, int status) {
+    const struct stream_run *run = &test->run;
+    struct throughput_meter *meter = &test->meter;
+    int i;
 
-    char url[MAX_URL_LENGTH];
-    strcpy(url, "http://");
-    strcat(url, host);
-    strcat(url, UPLOAD_PATH);
-
-    /* Generate upload data */
-    size_t upload_size = UPLOAD_SIZE_MB * 1024 * 1024;
-    char *upload_buffer = malloc(upload_size);
-    if (!upload_buffer) {
-        fprintf(stderr, "Failed to allocate upload buffer\n");
-        curl_easy_cleanup(curl);
-        return -1.0;
+    for (i = 0; i < test->stream_count; i++) {
+        transfer_engine_remove(run->engine, test->streams[i].curl);
+    }
+    if (status != 0) {
+        return;
     }
 
-    /* Fill with some data */
-    memset(upload_buffer, 'A', upload_size);
+    double elapsed = (run->active == 0 ? run->finished : monotonic_seconds()) - run->started;
+    if (meter->series && meter->first_byte > 0) {
+        series_record(meter->series, meter->first_byte, meter->last_byte, meter->total_bytes);
+    }
+    test->result->speed_mbps = report_streams(test->streams, test->stream_count, elapsed,
+                                              meter, test->is_upload, test->result);
+}
 
-    struct transfer_data data;
-    data.total_bytes = 0;
-    data.upload_buffer = upload_buffer;
-    data.upload_size = upload_size;
-    data.upload_sent = 0;
+static void speed_test_free(struct speed_test *test) {
+    int i;
 
-    struct progress_data progress;
-    progress.last_bytes_shown = 0;
-    progress.is_upload = 1;
+    if (test->streams) {
+        for (i = 0; i < test->stream_count; i++) {
+            if (test->streams[i].curl) {
+                curl_easy_cleanup(test->streams[i].curl);
+            }
+        }
+    }
+    free(test->streams);
+    test->streams = NULL;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_read_callback);
-    curl_easy_setopt(curl, CURLOPT_READDATA, &data);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)upload_size);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_response_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, transfer_progress_callback);
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)SPEEDTEST_TIMEOUT_SEC);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+/* Run one test on its own and return its speed_mbps */
+static double run_speed_test(const char *host, const struct test_options *options,
+                             int is_upload, struct test_result *result) {
+    const char *what = is_upload ? "upload speed to" : "download speed from";
+    struct speed_test test;
 
-    printf("Testing upload speed to %s...\n", host);
-    CURLcode res = curl_easy_perform(curl);
-    printf("\n");
+    if (speed_test_prepare(&test, host, options, is_upload, 0, result) == 0) {
+        if (test.stream_count > 1) {
+            printf("Testing %s %s over %d streams...\n", what, host, test.stream_count);
+        } else {
+            printf("Testing %s %s...\n", what, host);
+        }
+        int status = speed_test_start(&test) == 0 ? transfer_engine_run(options->engine) : -1;
+        printf("\n");
+        speed_test_finish(&test, status);
+    }
+    speed_test_free(&test);
+    return result->speed_mbps;
+}
 
-    double speed_mbps = -1.0;
-    double total_time;
-    long response_code;
+/*
+ * Test download speed over parallel connections and return the combined
+ * steady-state speed in Mbps, or -1.0 on failure. The details go to result,
+ * whose series must be released with series_free.
+ */
+double test_download_speed(const char *host, const struct test_options *options,
+                           struct test_result *result) {
+    return run_speed_test(host, options, 0, result);
+}
 
-    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+/*
+ * Test upload speed over parallel connections and return the combined
+ * steady-state speed in Mbps, or -1.0 on failure. The details go to result,
+ * whose series must be released with series_free.
+ */
+double test_upload_speed(const char *host, const struct test_options *options,
+                         struct test_result *result) {
+    return run_speed_test(host, options, 1, result);
+}
 
-    /* Handle timeout: calculate speed from data transferred before timeout */
-    if (res == CURLE_OPERATION_TIMEDOUT) {
-        if (data.total_bytes > 0 && total_time > 0) {
-            double speed_bps = (data.total_bytes * 8.0) / total_time;
-            speed_mbps = speed_bps / 1000000.0;
-            double mb_uploaded = data.total_bytes / (1024.0 * 1024.0);
-            printf("Uploaded %.2f MB in %.2f seconds (timeout reached)\n",
-                   mb_uploaded, total_time);
-        } else {
-            printf("Warning: Timeout reached but no data was uploaded\n");
-        }
-    } else if (res == CURLE_OK) {
-        if (response_code == 200 && total_time > 0 && data.total_bytes > 0) {
-            double speed_bps = (data.total_bytes * 8.0) / total_time;
-            speed_mbps = speed_bps / 1000000.0;
-            double mb_uploaded = data.total_bytes / (1024.0 * 1024.0);
-            printf("Uploaded %.2f MB in %.2f seconds\n", mb_uploaded, total_time);
+/*
+ * Test download and upload at the same time, so each direction is measured
+ * under load in the other. ACK compression and half-duplex links only show
+ * up this way. Both directions are sustained, and in adaptive mode the first
+ * to converge stops both, so they overlap for the whole test. The details go
+ * to download and upload, as for the single tests.
+ */
+void test_duplex_speed(const char *download_host, const char *upload_host,
+                       const struct test_options *options, struct test_result *download,
+                       struct test_result *upload) {
+    struct speed_test tests[2];
+    int stop = 0;
+
+    memset(tests, 0, sizeof(tests));
+    download->speed_mbps = -1.0;
+    upload->speed_mbps = -1.0;
+    if (speed_test_prepare(&tests[0], download_host, options, 0, 1, download) == 0 &&
+        speed_test_prepare(&tests[1], upload_host, options, 1, 1, upload) == 0) {
+        if (strcmp(download_host, upload_host) == 0) {
+            printf("Testing download and upload with %s at the same time", download_host);
         } else {
-            if (response_code != 200) {
-                printf("Warning: Server returned error code %ld\n", response_code);
-            } else {
-                printf("Warning: No data uploaded or time is zero\n");
-            }
+            printf("Testing download from %s and upload to %s at the same time",
+                   download_host, upload_host);
         }
-    } else {
-        fprintf(stderr, "Upload failed: %s\n", curl_easy_strerror(res));
+        if (options->stream_count > 1) {
+            printf(", %d streams each", options->stream_count);
+        }
+        printf("...\n");
+
+        /* Neither direction may run on without the other */
+        tests[0].meter.stop = &stop;
+        tests[1].meter.stop = &stop;
+
+        /* Two progress lines would overwrite each other */
+        tests[0].progress.silent = 1;
+        tests[1].progress.silent = 1;
+        int status = speed_test_start(&tests[0]) == 0 && speed_test_start(&tests[1]) == 0
+                         ? transfer_engine_run(options->engine) : -1;
+        speed_test_finish(&tests[0], status);
+        speed_test_finish(&tests[1], status);
+        printf("\n");
     }
-
-    free(upload_buffer);
-    curl_easy_cleanup(curl);
-    return speed_mbps;
+    speed_test_free(&tests[0]);
+    speed_test_free(&tests[1]);
 }
 
-/* Detect user's location using geolocation API */
-struct location *detect_location(void) {
-    CURL *curl = curl_easy_init();
-    struct location *loc = NULL;
+/* Geolocation API request running on the engine */
+struct location_request {
+    CURL *curl;
+    struct response_data response;
+    CURLcode result;
+};
 
-    if (!curl) {
+static void location_done(CURL *curl, CURLcode result, void *context) {
+    struct location_request *request = context;
+    (void)curl;
+    request->result = result;
+}
+
+/* Submit the geolocation API request. Returns 0 on success, -1 on error. */
+static int location_request_start(struct transfer_engine *engine,
+                                  struct location_request *request) {
+    request->response.buffer = NULL;
+    request->response.size = 0;
+    request->result = CURLE_FAILED_INIT;
+    request->curl = curl_easy_init();
+    if (!request->curl) {
         fprintf(stderr, "Failed to initialize curl for location detection\n");
-        return NULL;
+        return -1;
     }
 
-    struct response_data response;
-    response.buffer = NULL;
-    response.size = 0;
+    curl_easy_setopt(request->curl, CURLOPT_URL, LOCATION_API_URL);
+    curl_easy_setopt(request->curl, CURLOPT_WRITEFUNCTION, api_response_callback);
+    curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, &request->response);
+    curl_easy_setopt(request->curl, CURLOPT_TIMEOUT, (long)LOCATION_API_TIMEOUT_SEC);
+    if (transfer_engine_add(engine, request->curl, location_done, request) != 0) {
+        curl_easy_cleanup(request->curl);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Wait for a started request, then parse its response and release it.
+ * Returns the location, or NULL on failure.
+ */
+static struct location *location_request_finish(struct transfer_engine *engine,
+                                                struct location_request *request) {
+    struct location *loc = NULL;
 
-    curl_easy_setopt(curl, CURLOPT_URL, LOCATION_API_URL);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, api_response_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)LOCATION_API_TIMEOUT_SEC);
+    transfer_engine_run(engine);
+    transfer_engine_remove(engine, request->curl);
 
-    CURLcode res = curl_easy_perform(curl);
+    /*
+     * The response tree is only needed until the two fields are copied out,
+     * so its nodes come from an arena and its strings stay in the response
+     * buffer, which is parsed in place.
+     */
+    cJSON_Arena *arena = cJSON_CreateArena(LOCATION_ARENA_BLOCK_SIZE);
 
-    if (res == CURLE_OK && response.buffer) {
-        cJSON *json = cJSON_Parse(response.buffer);
+    if (request->result == CURLE_OK && request->response.buffer) {
+        cJSON *json = arena ? cJSON_ParseInSituInArena(arena, request->response.buffer,
+                                                        request->response.size)
+                            : NULL;
         if (json) {
             loc = malloc(sizeof(struct location));
             if (loc) {
@@ -538,18 +1406,96 @@ struct location *detect_location(void) {
                     }
                 }
             }
-            cJSON_Delete(json);
         }
     } else {
-        fprintf(stderr, "Location detection failed: %s\n", curl_easy_strerror(res));
+        fprintf(stderr, "Location detection failed: %s\n",
+                curl_easy_strerror(request->result));
     }
 
-    free(response.buffer);
-    curl_easy_cleanup(curl);
+    cJSON_DeleteArena(arena);
+    free(request->response.buffer);
+    curl_easy_cleanup(request->curl);
 
     return loc;
 }
 
+/* Detect user's location using geolocation API */
+struct location *detect_location(struct transfer_engine *engine) {
+    struct location_request request;
+
+    if (location_request_start(engine, &request) != 0) {
+        return NULL;
+    }
+    return location_request_finish(engine, &request);
+}
+
+/* Server list load running on a worker thread */
+struct server_load {
+    const char *path;
+    struct server_list *list;
+};
+
+static void *server_load_thread(void *arg) {
+    struct server_load *load = arg;
+    load->list = server_list_load(load->path);
+    return NULL;
+}
+
+/*
+ * Load the server list and, with detect set, detect the location into *loc
+ * at the same time: the list is read and indexed on a worker thread while
+ * the geolocation request waits on the network, so a cold start takes the
+ * longer of the two instead of their sum. The response is parsed only after
+ * the join, since cJSON keeps its error position in a global. Returns the
+ * list, or NULL on error.
+ */
+static struct server_list *locate_and_load(struct transfer_engine *engine, int detect,
+                                           struct location **loc) {
+    struct location_request request;
+    struct server_load load;
+    pthread_t thread;
+
+    int requested = detect && location_request_start(engine, &request) == 0;
+    load.path = SERVER_LIST_PATH;
+    load.list = NULL;
+    int threaded = requested && pthread_create(&thread, NULL, server_load_thread, &load) == 0;
+    if (!threaded) {
+        server_load_thread(&load);
+    }
+
+    if (requested) {
+        transfer_engine_run(engine);
+    }
+    if (threaded) {
+        pthread_join(thread, NULL);
+    }
+    if (requested) {
+        *loc = location_request_finish(engine, &request);
+    }
+    return load.list;
+}
+
+/* Print a direction's duplex rate next to its rate when tested alone */
+static void print_duplex_result(const char *direction, double duplex_mbps,
+                                double sequential_mbps) {
+    if (duplex_mbps < 0.0) {
+        printf("%s under duplex load: Failed\n", direction);
+    } else if (sequential_mbps < 0.0) {
+        printf("%s under duplex load: %.2f Mbps\n", direction, duplex_mbps);
+    } else {
+        printf("%s under duplex load: %.2f Mbps (alone %.2f Mbps)\n", direction,
+               duplex_mbps, sequential_mbps);
+    }
+}
+
+/* Finish a result line with the percentiles used for SLA reporting, if any */
+static void print_percentiles(const struct interval_stats *stats) {
+    if (stats->count > 0) {
+        printf(" (p10 %.2f, median %.2f)", stats->p10, stats->p50);
+    }
+    printf("\n");
+}
+
 static void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n\n", program_name);
     printf("Options:\n");
@@ -558,6 +1504,35 @@ static void print_usage(const char *program_name) {
     printf("  -u, --upload <server>    Test upload speed with specified server\n");
     printf("  -s, --server             Find best server by location\n");
     printf("  -l, --location           Detect user location\n");
+    printf("      --country <name>     Only use servers in this country\n");
+    printf("      --city <name>        Only use servers in this city (needs --country)\n");
+    printf("      --probe-concurrency <n>\n");
+    printf("                           Max parallel reachability probes (default %d)\n",
+           PROBE_DEFAULT_CONCURRENCY);
+    printf("      --rank-latency       Pick the server with the lowest median latency\n");
+    printf("      --latency-candidates <n>\n");
+    printf("                           Servers timed per tier when ranking (default %d)\n",
+           LATENCY_DEFAULT_CANDIDATES);
+    printf("      --latency-rounds <n> Round trips per timed server (default %d)\n",
+           LATENCY_DEFAULT_ROUNDS);
+    printf("      --streams <n>        Parallel connections for the speed tests\n");
+    printf("                           (default %d, at most %d)\n", DEFAULT_STREAMS,
+           MAX_STREAMS);
+    printf("      --warmup <seconds>   Start of each test left out of the steady-state\n");
+    printf("                           rate (default %g)\n", WARMUP_DEFAULT_SEC);
+    printf("      --adaptive           End each test once its rate stops changing\n");
+    printf("      --escalate           Download ever larger images until the shortest\n");
+    printf("                           test time has passed\n");
+    printf("      --min-duration <seconds>\n");
+    printf("                           Shortest adaptive or escalating test (default %g)\n",
+           ADAPTIVE_MIN_DURATION_SEC);
+    printf("      --max-duration <seconds>\n");
+    printf("                           Longest test (default %d)\n", SPEEDTEST_TIMEOUT_SEC);
+    printf("      --series <file>      Write each test's throughput every %d ms as CSV\n",
+           (int)(SERIES_INTERVAL_SEC * 1000));
+    printf("      --duplex             Also test download and upload at the same time\n");
+    printf("                           (with -a, or with both -d and -u); with\n");
+    printf("                           --adaptive, both stop once either converges\n");
     printf("  -h, --help               Show this help message\n");
 }
 
@@ -573,6 +1548,25 @@ int main(int argc, char *argv[]) {
     int do_automated = 0;
     const char *download_server = NULL;
     const char *upload_server = NULL;
+    const char *country_filter = NULL;
+    const char *city_filter = NULL;
+    struct selection_options selection;
+    selection.max_concurrency = PROBE_DEFAULT_CONCURRENCY;
+    selection.rank_by_latency = 0;
+    selection.latency_candidates = LATENCY_DEFAULT_CANDIDATES;
+    selection.latency_rounds = LATENCY_DEFAULT_ROUNDS;
+    selection.location_filter = 0;
+    selection.engine = NULL;
+    struct test_options test;
+    test.stream_count = DEFAULT_STREAMS;
+    test.warmup = WARMUP_DEFAULT_SEC;
+    test.adaptive = 0;
+    test.escalate = 0;
+    test.engine = NULL;
+    test.min_duration = ADAPTIVE_MIN_DURATION_SEC;
+    test.max_duration = SPEEDTEST_TIMEOUT_SEC;
+    const char *series_path = NULL;
+    int do_duplex = 0;
 
     static struct option long_options[] = {
         {"download", required_argument, 0, 'd'},
@@ -581,6 +1575,20 @@ int main(int argc, char *argv[]) {
         {"location", no_argument, 0, 'l'},
         {"automated", no_argument, 0, 'a'},
         {"help", no_argument, 0, 'h'},
+        {"probe-concurrency", required_argument, 0, OPT_PROBE_CONCURRENCY},
+        {"rank-latency", no_argument, 0, OPT_RANK_LATENCY},
+        {"latency-candidates", required_argument, 0, OPT_LATENCY_CANDIDATES},
+        {"latency-rounds", required_argument, 0, OPT_LATENCY_ROUNDS},
+        {"country", required_argument, 0, OPT_COUNTRY},
+        {"city", required_argument, 0, OPT_CITY},
+        {"streams", required_argument, 0, OPT_STREAMS},
+        {"warmup", required_argument, 0, OPT_WARMUP},
+        {"adaptive", no_argument, 0, OPT_ADAPTIVE},
+        {"escalate", no_argument, 0, OPT_ESCALATE},
+        {"min-duration", required_argument, 0, OPT_MIN_DURATION},
+        {"max-duration", required_argument, 0, OPT_MAX_DURATION},
+        {"series", required_argument, 0, OPT_SERIES},
+        {"duplex", no_argument, 0, OPT_DUPLEX},
         {0, 0, 0, 0}};
 
     while ((option = getopt_long(argc, argv, "d:u:slah", long_options,
@@ -615,6 +1623,92 @@ int main(int argc, char *argv[]) {
             case 'a':
                 do_automated = 1;
                 break;
+            case OPT_PROBE_CONCURRENCY:
+                selection.max_concurrency = atoi(optarg);
+                if (selection.max_concurrency <= 0) {
+                    fprintf(stderr, "Error: --probe-concurrency must be positive\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_RANK_LATENCY:
+                selection.rank_by_latency = 1;
+                break;
+            case OPT_LATENCY_CANDIDATES:
+                selection.latency_candidates = atoi(optarg);
+                if (selection.latency_candidates <= 0) {
+                    fprintf(stderr, "Error: --latency-candidates must be positive\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_LATENCY_ROUNDS:
+                selection.latency_rounds = atoi(optarg);
+                if (selection.latency_rounds <= 0) {
+                    fprintf(stderr, "Error: --latency-rounds must be positive\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_COUNTRY:
+                country_filter = optarg;
+                selection.location_filter = 1;
+                break;
+            case OPT_CITY:
+                city_filter = optarg;
+                break;
+            case OPT_STREAMS:
+                test.stream_count = atoi(optarg);
+                if (test.stream_count <= 0 || test.stream_count > MAX_STREAMS) {
+                    fprintf(stderr, "Error: --streams must be between 1 and %d\n",
+                            MAX_STREAMS);
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_WARMUP:
+                test.warmup = atof(optarg);
+                if (test.warmup < 0) {
+                    fprintf(stderr, "Error: --warmup must not be negative\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_ADAPTIVE:
+                test.adaptive = 1;
+                break;
+            case OPT_ESCALATE:
+                test.escalate = 1;
+                break;
+            case OPT_MIN_DURATION:
+                test.min_duration = atof(optarg);
+                if (test.min_duration <= 0) {
+                    fprintf(stderr, "Error: --min-duration must be positive\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_MAX_DURATION:
+                test.max_duration = atof(optarg);
+                if (test.max_duration <= 0) {
+                    fprintf(stderr, "Error: --max-duration must be positive\n");
+                    print_usage(argv[0]);
+                    curl_global_cleanup();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_SERIES:
+                series_path = optarg;
+                break;
+            case OPT_DUPLEX:
+                do_duplex = 1;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 curl_global_cleanup();
@@ -626,6 +1720,28 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (city_filter && !country_filter) {
+        fprintf(stderr, "Error: --city requires --country\n");
+        print_usage(argv[0]);
+        curl_global_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    if (test.warmup >= test.max_duration ||
+        ((test.adaptive || test.escalate) && test.min_duration > test.max_duration)) {
+        fprintf(stderr, "Error: --warmup and --min-duration must fit in --max-duration\n");
+        print_usage(argv[0]);
+        curl_global_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    if (do_duplex && !do_automated && !(do_download && do_upload)) {
+        fprintf(stderr, "Error: --duplex requires -a, or both -d and -u\n");
+        print_usage(argv[0]);
+        curl_global_cleanup();
+        return EXIT_FAILURE;
+    }
+
     /* If no options provided, show usage */
     if (!do_download && !do_upload && !do_find_server && !do_location &&
         !do_automated) {
@@ -634,86 +1750,143 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    FILE *series_file = NULL;
+    if (series_path) {
+        series_file = fopen(series_path, "w");
+        if (!series_file) {
+            fprintf(stderr, "Error: Cannot write %s\n", series_path);
+            curl_global_cleanup();
+            return EXIT_FAILURE;
+        }
+        fprintf(series_file, "test,seconds,bytes,mbps\n");
+    }
+
+    struct test_result download_result;
+    struct test_result upload_result;
+    struct test_result duplex_download_result;
+    struct test_result duplex_upload_result;
+    memset(&download_result, 0, sizeof(download_result));
+    memset(&upload_result, 0, sizeof(upload_result));
+    memset(&duplex_download_result, 0, sizeof(duplex_download_result));
+    memset(&duplex_upload_result, 0, sizeof(duplex_upload_result));
+
+    /* All transfers of the run, so later phases reuse earlier connections */
+    struct transfer_engine *engine = transfer_engine_create();
+    if (!engine) {
+        fprintf(stderr, "Error: Failed to start the transfer engine\n");
+        if (series_file) {
+            fclose(series_file);
+        }
+        curl_global_cleanup();
+        return EXIT_FAILURE;
+    }
+    selection.engine = engine;
+    test.engine = engine;
+
     struct location *loc = NULL;
-    cJSON *json = NULL;
-    cJSON *best_server = NULL;
+    struct server_list *servers = NULL;
+    const char *user_country = NULL;
+    const char *user_city = NULL;
     const char *test_server_host = NULL;
     double download_speed = -1.0;
     double upload_speed = -1.0;
 
     if (do_automated) {
-        /* 1. Detect location */
-        printf("Detecting location...\n");
-        loc = detect_location();
-        if (loc) {
-            printf("Location detected: %s", loc->country ? loc->country : "Unknown");
-            if (loc->city) {
-                printf(", %s", loc->city);
+        /* 1. Detect location, loading the server list meanwhile */
+        if (country_filter) {
+            printf("Using location: %s", country_filter);
+            if (city_filter) {
+                printf(", %s", city_filter);
             }
             printf("\n");
+            servers = locate_and_load(engine, 0, &loc);
         } else {
-            printf("Warning: Failed to detect location, continuing anyway...\n");
+            printf("Detecting location...\n");
+            servers = locate_and_load(engine, 1, &loc);
+            if (loc) {
+                printf("Location detected: %s", loc->country ? loc->country : "Unknown");
+                if (loc->city) {
+                    printf(", %s", loc->city);
+                }
+                printf("\n");
+            } else {
+                printf("Warning: Failed to detect location, continuing anyway...\n");
+            }
         }
         printf("\n");
 
         /* 2. Find best server */
         printf("Finding best server...\n");
-        json = read_json_file("speedtest_server_list.json");
-        if (!json || !cJSON_IsArray(json)) {
+        if (!servers) {
             printf("Error: Failed to read or parse server list\n");
         } else {
-            int count = cJSON_GetArraySize(json);
-            printf("Found %d servers in list\n", count);
+            printf("Found %d servers in list\n", servers->count);
 
-            const char *user_country = loc ? loc->country : NULL;
-            const char *user_city = loc ? loc->city : NULL;
-            best_server = find_best_server(json, user_country, user_city);
-            if (!best_server) {
+            user_country = country_filter ? country_filter : (loc ? loc->country : NULL);
+            user_city = country_filter ? city_filter : (loc ? loc->city : NULL);
+            int best_server = find_best_server(servers, user_country, user_city,
+                                               &selection);
+            if (best_server < 0) {
                 printf("Error: No suitable server found\n");
             } else {
-                cJSON *host_item = cJSON_GetObjectItem(best_server, "host");
-                test_server_host = cJSON_GetStringValue(host_item);
-                if (!test_server_host) {
-                    printf("Error: Best server has no host\n");
+                test_server_host = servers->servers[best_server].host;
+                printf("Best server selected: %s\n", test_server_host);
+                printf("\n");
+
+                /* 3. Download test */
+                download_speed = test_download_speed(test_server_host, &test,
+                                                     &download_result);
+                printf("\n");
+
+                /* 4. Upload test */
+                upload_speed = test_upload_speed(test_server_host, &test, &upload_result);
+                printf("\n");
+
+                /* 5. Both directions at once */
+                if (do_duplex) {
+                    test_duplex_speed(test_server_host, test_server_host, &test,
+                                      &duplex_download_result, &duplex_upload_result);
+                }
+
+                /* 6. Print final results */
+                printf("Results:\n");
+                printf("========\n");
+                if (download_speed >= 0.0) {
+                    printf("Download speed: %.2f Mbps", download_speed);
+                    print_percentiles(&download_result.stats);
                 } else {
-                    printf("Best server selected: %s\n", test_server_host);
-                    printf("\n");
-
-                    /* 3. Download test */
-                    download_speed = test_download_speed(test_server_host);
-                    printf("\n");
-
-                    /* 4. Upload test */
-                    upload_speed = test_upload_speed(test_server_host);
-                    printf("\n");
-
-                    /* 5. Print final results */
-                    printf("Results:\n");
-                    printf("========\n");
-                    if (download_speed >= 0.0) {
-                        printf("Download speed: %.2f Mbps\n", download_speed);
-                    } else {
-                        printf("Download speed: Failed\n");
-                    }
-                    if (upload_speed >= 0.0) {
-                        printf("Upload speed: %.2f Mbps\n", upload_speed);
-                    } else {
-                        printf("Upload speed: Failed\n");
-                    }
-                    if (test_server_host) {
-                        printf("Server: %s\n", test_server_host);
-                    }
-                    if (loc && loc->country) {
-                        printf("Location: %s\n", loc->country);
-                    }
-                    printf("\n");
+                    printf("Download speed: Failed\n");
+                }
+                if (upload_speed >= 0.0) {
+                    printf("Upload speed: %.2f Mbps", upload_speed);
+                    print_percentiles(&upload_result.stats);
+                } else {
+                    printf("Upload speed: Failed\n");
+                }
+                if (do_duplex) {
+                    print_duplex_result("Download", duplex_download_result.speed_mbps,
+                                        download_speed);
+                    print_duplex_result("Upload", duplex_upload_result.speed_mbps,
+                                        upload_speed);
                 }
+                if (test_server_host) {
+                    printf("Server: %s\n", test_server_host);
+                }
+                if (user_country) {
+                    printf("Location: %s\n", user_country);
+                }
+                printf("\n");
             }
         }
     } else {
         if (do_location) {
             printf("Detecting location...\n");
-            loc = detect_location();
+            /* Finding a server needs the list, so load it meanwhile */
+            if (do_find_server) {
+                servers = locate_and_load(engine, 1, &loc);
+            } else {
+                loc = detect_location(engine);
+            }
             if (loc) {
                 printf("Country: %s\n", loc->country ? loc->country : "Unknown");
                 if (loc->city) {
@@ -726,30 +1899,20 @@ int main(int argc, char *argv[]) {
 
         if (do_find_server) {
             printf("Finding best server...\n");
-            if (!loc) {
-                loc = detect_location();
+            if (!do_location) {
+                servers = locate_and_load(engine, !country_filter, &loc);
             }
-            json = read_json_file("speedtest_server_list.json");
-            if (json && cJSON_IsArray(json)) {
-                int count = cJSON_GetArraySize(json);
-                printf("Found %d servers in list\n", count);
-
-                const char *user_country = loc ? loc->country : NULL;
-                const char *user_city = loc ? loc->city : NULL;
-                best_server = find_best_server(json, user_country, user_city);
-                if (best_server) {
-                    cJSON *host_item = cJSON_GetObjectItem(best_server, "host");
-                    cJSON *country_item = cJSON_GetObjectItem(best_server, "country");
-                    cJSON *city_item = cJSON_GetObjectItem(best_server, "city");
-                    const char *host = cJSON_GetStringValue(host_item);
-                    const char *country = cJSON_GetStringValue(country_item);
-                    const char *city = cJSON_GetStringValue(city_item);
-
-                    printf("Best server: %s", host ? host : "Unknown");
-                    if (country) {
-                        printf(" (%s, %s)", country, city);
-                    }
-                    printf("\n");
+            if (servers) {
+                printf("Found %d servers in list\n", servers->count);
+
+                user_country = country_filter ? country_filter : (loc ? loc->country : NULL);
+                user_city = country_filter ? city_filter : (loc ? loc->city : NULL);
+                int best_server = find_best_server(servers, user_country, user_city,
+                                                   &selection);
+                if (best_server >= 0) {
+                    const struct server *server = &servers->servers[best_server];
+                    printf("Best server: %s (%s, %s)\n", server->host, server->country,
+                           server->city);
                 } else {
                     printf("No suitable server found\n");
                 }
@@ -758,23 +1921,43 @@ int main(int argc, char *argv[]) {
             }
         }
         if (do_download) {
-            double speed = test_download_speed(download_server);
+            double speed = test_download_speed(download_server, &test, &download_result);
             if (speed >= 0.0) {
                 printf("Download speed: %.2f Mbps\n", speed);
             }
         }
         if (do_upload) {
-            double speed = test_upload_speed(upload_server);
+            double speed = test_upload_speed(upload_server, &test, &upload_result);
             if (speed >= 0.0) {
                 printf("Upload speed: %.2f Mbps\n", speed);
             }
         }
+        if (do_duplex) {
+            printf("\n");
+            test_duplex_speed(download_server, upload_server, &test, &duplex_download_result,
+                              &duplex_upload_result);
+            print_duplex_result("Download", duplex_download_result.speed_mbps,
+                                download_result.speed_mbps);
+            print_duplex_result("Upload", duplex_upload_result.speed_mbps,
+                                upload_result.speed_mbps);
+        }
     }
 
-    /* Cleanup */
-    if (json) {
-        cJSON_Delete(json);
+    if (series_file) {
+        write_series(series_file, "download", &download_result.series);
+        write_series(series_file, "upload", &upload_result.series);
+        write_series(series_file, "duplex-download", &duplex_download_result.series);
+        write_series(series_file, "duplex-upload", &duplex_upload_result.series);
+        fclose(series_file);
     }
+
+    /* Cleanup */
+    series_free(&download_result.series);
+    series_free(&upload_result.series);
+    series_free(&duplex_download_result.series);
+    series_free(&duplex_upload_result.series);
+    server_list_free(servers);
+    transfer_engine_free(engine);
     curl_global_cleanup();
     if (loc) {
         if (loc->country) {
@@ -0,0 +1,95 @@
+#include "payload.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PAYLOAD_STEP_SIZE (PAYLOAD_LANES * 8)
+
+/* splitmix64, used only to spread a seed over the generator state */
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+void payload_seed(struct payload_generator *generator, uint64_t seed) {
+    int i;
+    for (i = 0; i < PAYLOAD_LANES; i++) {
+        generator->s0[i] = splitmix64(&seed);
+        generator->s1[i] = splitmix64(&seed);
+        if ((generator->s0[i] | generator->s1[i]) == 0) {
+            generator->s1[i] = 1; /* The all-zero state never leaves zero */
+        }
+    }
+}
+
+#if defined(__SSE2__)
+/* One xorshift128+ step on two lanes at once */
+#define XORSHIFT128PLUS_STEP(a, b, out) do {                                   \
+        __m128i x = (a);                                                       \
+        __m128i y = (b);                                                       \
+        (out) = _mm_add_epi64(x, y);                                           \
+        (a) = y;                                                               \
+        x = _mm_xor_si128(x, _mm_slli_epi64(x, 23));                           \
+        (b) = _mm_xor_si128(_mm_xor_si128(x, y),                               \
+                            _mm_xor_si128(_mm_srli_epi64(x, 18),               \
+                                          _mm_srli_epi64(y, 5)));              \
+    } while (0)
+
+/* Write steps * 32 bytes of output to out */
+static void generate_steps(struct payload_generator *generator, unsigned char *out,
+                           size_t steps) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)&generator->s0[0]);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)&generator->s0[2]);
+    __m128i b0 = _mm_loadu_si128((const __m128i *)&generator->s1[0]);
+    __m128i b1 = _mm_loadu_si128((const __m128i *)&generator->s1[2]);
+    __m128i r0, r1;
+
+    for (; steps > 0; steps--, out += PAYLOAD_STEP_SIZE) {
+        XORSHIFT128PLUS_STEP(a0, b0, r0);
+        XORSHIFT128PLUS_STEP(a1, b1, r1);
+        _mm_storeu_si128((__m128i *)out, r0);
+        _mm_storeu_si128((__m128i *)(out + 16), r1);
+    }
+
+    _mm_storeu_si128((__m128i *)&generator->s0[0], a0);
+    _mm_storeu_si128((__m128i *)&generator->s0[2], a1);
+    _mm_storeu_si128((__m128i *)&generator->s1[0], b0);
+    _mm_storeu_si128((__m128i *)&generator->s1[2], b1);
+}
+#else
+static void generate_steps(struct payload_generator *generator, unsigned char *out,
+                           size_t steps) {
+    for (; steps > 0; steps--, out += PAYLOAD_STEP_SIZE) {
+        int i;
+        for (i = 0; i < PAYLOAD_LANES; i++) {
+            uint64_t x = generator->s0[i];
+            uint64_t y = generator->s1[i];
+            uint64_t result = x + y;
+            generator->s0[i] = y;
+            x ^= x << 23;
+            generator->s1[i] = x ^ y ^ (x >> 18) ^ (y >> 5);
+            memcpy(out + i * 8, &result, 8);
+        }
+    }
+}
+#endif
+
+void payload_fill(struct payload_generator *generator, char *buffer, size_t size) {
+    unsigned char *out = (unsigned char *)buffer;
+    size_t steps = size / PAYLOAD_STEP_SIZE;
+
+    generate_steps(generator, out, steps);
+    out += steps * PAYLOAD_STEP_SIZE;
+    size -= steps * PAYLOAD_STEP_SIZE;
+
+    /* A partial step; the rest of its output is dropped */
+    if (size > 0) {
+        unsigned char last[PAYLOAD_STEP_SIZE];
+        generate_steps(generator, last, 1);
+        memcpy(out, last, size);
+    }
+}
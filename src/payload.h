@@ -0,0 +1,26 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Incompressible upload payload. Four xorshift128+ generators run side by
+ * side, as two SSE2 vectors where available, and emit 32 bytes per step.
+ * The output never repeats in practice, so compressing or deduplicating
+ * middleboxes cannot shrink the upload.
+ */
+#define PAYLOAD_LANES 4
+
+struct payload_generator {
+    uint64_t s0[PAYLOAD_LANES];
+    uint64_t s1[PAYLOAD_LANES];
+};
+
+/* Derive the generator state from seed; different seeds give unrelated output */
+void payload_seed(struct payload_generator *generator, uint64_t seed);
+
+/* Fill buffer with the next size bytes of output */
+void payload_fill(struct payload_generator *generator, char *buffer, size_t size);
+
+#endif
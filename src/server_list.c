@@ -0,0 +1,832 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cJSON.h"
+#include "server_list.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Growable buffer for the string pool while the table is compiled. Strings are
+ * interned, so equal strings share one offset and offsets double as keys.
+ */
+struct string_pool {
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint32_t *slots;  /* Open-addressing set of offset + 1, 0 when empty */
+    size_t slot_count;
+    size_t used_slots;
+};
+
+static uint32_t hash_string(const char *str) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void pool_free(struct string_pool *pool) {
+    free(pool->data);
+    free(pool->slots);
+}
+
+/* Double the intern set and rehash every pooled string. Returns 0 on success. */
+static int pool_grow_slots(struct string_pool *pool) {
+    size_t slot_count = pool->slot_count ? pool->slot_count * 2 : 4096;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    size_t i;
+
+    if (!slots) {
+        return -1;
+    }
+    for (i = 0; i < pool->slot_count; i++) {
+        if (pool->slots[i]) {
+            size_t slot = hash_string(pool->data + pool->slots[i] - 1) & (slot_count - 1);
+            while (slots[slot]) {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            slots[slot] = pool->slots[i];
+        }
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = slot_count;
+    return 0;
+}
+
+/* Intern a string in the pool and store its offset. Returns 0 on success. */
+static int pool_add(struct string_pool *pool, const char *str, uint32_t *offset) {
+    size_t len = strlen(str) + 1;
+    size_t slot;
+
+    if ((pool->used_slots + 1) * 2 > pool->slot_count && pool_grow_slots(pool) != 0) {
+        return -1;
+    }
+
+    slot = hash_string(str) & (pool->slot_count - 1);
+    while (pool->slots[slot]) {
+        if (strcmp(pool->data + pool->slots[slot] - 1, str) == 0) {
+            *offset = pool->slots[slot] - 1;
+            return 0;
+        }
+        slot = (slot + 1) & (pool->slot_count - 1);
+    }
+
+    if (pool->size + len >= UINT32_MAX) {
+        return -1;
+    }
+    if (pool->size + len > pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : 64 * 1024;
+        while (capacity < pool->size + len) {
+            capacity *= 2;
+        }
+        char *data = realloc(pool->data, capacity);
+        if (!data) {
+            return -1;
+        }
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+
+    memcpy(pool->data + pool->size, str, len);
+    *offset = (uint32_t)pool->size;
+    pool->slots[slot] = (uint32_t)pool->size + 1;
+    pool->used_slots++;
+    pool->size += len;
+    return 0;
+}
+
+/*
+ * Map a whole file read-only. build_table parses with an explicit length, so
+ * the file is used in place: no copy, no NUL terminator. Returns NULL on error.
+ */
+static const char *map_file(const char *filename, size_t *length) {
+    struct stat file_stat;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening file: %s\n", filename);
+        return NULL;
+    }
+
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        fprintf(stderr, "Error: Invalid file size: %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map file: %s\n", filename);
+        return NULL;
+    }
+
+    /* The SAX parser makes a single forward pass */
+    posix_madvise(mapping, (size_t)file_stat.st_size, POSIX_MADV_SEQUENTIAL);
+
+    *length = (size_t)file_stat.st_size;
+    return mapping;
+}
+
+static void unmap_file(const char *mapping, size_t length) {
+    munmap((void *)mapping, length);
+}
+
+/* Show where parsing stopped; the input is not NUL-terminated */
+static void print_parse_error(const char *json, size_t length) {
+    const char *error = cJSON_GetErrorPtr();
+    size_t remaining = length - (size_t)(error - json);
+
+    fprintf(stderr, "Parse error: %.*s\n", (int)(remaining < 100 ? remaining : 100), error);
+}
+
+/* Copy of one string field of the server being read */
+struct field_buffer {
+    char *data;
+    size_t capacity;
+    int present; /* The key was seen; later duplicates are ignored */
+    int is_string;
+};
+
+enum server_field {
+    FIELD_NONE = -1,
+    FIELD_HOST,
+    FIELD_COUNTRY,
+    FIELD_CITY,
+    FIELD_PROVIDER,
+    FIELD_ID,
+    FIELD_COUNT
+};
+
+static const char *const field_names[FIELD_COUNT] = {"host", "country", "city",
+                                                     "provider", "id"};
+
+/*
+ * State of the streaming server list reader. Only the server currently being
+ * read is held in memory; it is compiled into the table when its object ends.
+ */
+struct list_reader {
+    int depth;                      /* 1 inside the top-level array, 2 in a server */
+    enum server_field field;        /* Field the next value at depth 2 belongs to */
+    struct field_buffer strings[FIELD_ID];
+    int id_present;                 /* The id key was seen */
+    int has_id;                     /* ... and its value is a number */
+    double id;
+    struct string_pool pool;
+    struct server_record *records;
+    size_t count;
+    size_t capacity;
+    int is_array;                   /* The top-level value is an array */
+    int failed;                     /* Out of memory, as opposed to a parse error */
+};
+
+/* Mark the field the current value belongs to as seen. Returns the field. */
+static enum server_field reader_take_field(struct list_reader *reader) {
+    enum server_field field = reader->field;
+
+    reader->field = FIELD_NONE;
+    if (reader->depth != 2 || field == FIELD_NONE) {
+        return FIELD_NONE;
+    }
+    if (field == FIELD_ID) {
+        reader->id_present = 1;
+    } else {
+        reader->strings[field].present = 1;
+    }
+    return field;
+}
+
+static cJSON_bool reader_start_container(void *context) {
+    struct list_reader *reader = context;
+    int i;
+
+    /* A container as a field value makes that field unusable */
+    reader_take_field(reader);
+    reader->depth++;
+    if (reader->depth == 2) {
+        /* A new server object: forget the previous one */
+        for (i = 0; i < FIELD_ID; i++) {
+            reader->strings[i].present = 0;
+            reader->strings[i].is_string = 0;
+        }
+        reader->id_present = 0;
+        reader->has_id = 0;
+        reader->field = FIELD_NONE;
+    }
+    return 1;
+}
+
+static cJSON_bool reader_start_array(void *context) {
+    struct list_reader *reader = context;
+
+    if (reader->depth == 0) {
+        reader->is_array = 1;
+    }
+    return reader_start_container(context);
+}
+
+static cJSON_bool reader_start_object(void *context) {
+    struct list_reader *reader = context;
+
+    /* The list itself must be an array */
+    return reader->depth > 0 && reader_start_container(context);
+}
+
+/* Store the server that just ended, if it has the fields selection needs */
+static int reader_finish_server(struct list_reader *reader) {
+    struct field_buffer *strings = reader->strings;
+    struct server_record *record;
+
+    if (!strings[FIELD_HOST].is_string || !strings[FIELD_COUNTRY].is_string ||
+        !strings[FIELD_CITY].is_string) {
+        return 0;
+    }
+
+    if (reader->count == reader->capacity) {
+        size_t capacity = reader->capacity ? reader->capacity * 2 : 1024;
+        record = realloc(reader->records, capacity * sizeof(struct server_record));
+        if (!record) {
+            return -1;
+        }
+        reader->records = record;
+        reader->capacity = capacity;
+    }
+
+    record = &reader->records[reader->count];
+    if (pool_add(&reader->pool, strings[FIELD_HOST].data, &record->host) != 0 ||
+        pool_add(&reader->pool, strings[FIELD_COUNTRY].data, &record->country) != 0 ||
+        pool_add(&reader->pool, strings[FIELD_CITY].data, &record->city) != 0 ||
+        pool_add(&reader->pool,
+                 strings[FIELD_PROVIDER].is_string ? strings[FIELD_PROVIDER].data : "",
+                 &record->provider) != 0) {
+        return -1;
+    }
+
+    /* Saturate like cJSON's valueint */
+    if (!reader->has_id) {
+        record->id = -1;
+    } else if (reader->id >= INT32_MAX) {
+        record->id = INT32_MAX;
+    } else if (reader->id <= INT32_MIN) {
+        record->id = INT32_MIN;
+    } else {
+        record->id = (int32_t)reader->id;
+    }
+
+    reader->count++;
+    return 0;
+}
+
+static cJSON_bool reader_end_container(void *context) {
+    struct list_reader *reader = context;
+
+    if (reader->depth == 2 && reader_finish_server(reader) != 0) {
+        reader->failed = 1;
+        return 0;
+    }
+    reader->depth--;
+    reader->field = FIELD_NONE;
+    return 1;
+}
+
+static cJSON_bool reader_key(void *context, const char *key, size_t length) {
+    struct list_reader *reader = context;
+    int i;
+
+    if (reader->depth != 2) {
+        return 1;
+    }
+
+    reader->field = FIELD_NONE;
+    for (i = 0; i < FIELD_COUNT; i++) {
+        if (strlen(field_names[i]) == length && memcmp(field_names[i], key, length) == 0) {
+            int seen = (i == FIELD_ID) ? reader->id_present : reader->strings[i].present;
+            /* The first occurrence of a key wins */
+            if (!seen) {
+                reader->field = (enum server_field)i;
+            }
+            break;
+        }
+    }
+    return 1;
+}
+
+static cJSON_bool reader_string(void *context, const char *value, size_t length) {
+    struct list_reader *reader = context;
+    enum server_field field = reader_take_field(reader);
+
+    /* A non-numeric id counts as missing */
+    if (field == FIELD_NONE || field == FIELD_ID) {
+        return 1;
+    }
+
+    struct field_buffer *buffer = &reader->strings[field];
+    if (length + 1 > buffer->capacity) {
+        char *data = realloc(buffer->data, length + 1);
+        if (!data) {
+            reader->failed = 1;
+            return 0;
+        }
+        buffer->data = data;
+        buffer->capacity = length + 1;
+    }
+    memcpy(buffer->data, value, length);
+    buffer->data[length] = '\0';
+    buffer->is_string = 1;
+    return 1;
+}
+
+static cJSON_bool reader_number(void *context, double value) {
+    struct list_reader *reader = context;
+
+    if (reader_take_field(reader) == FIELD_ID) {
+        reader->has_id = 1;
+        reader->id = value;
+    }
+    return 1;
+}
+
+/* true, false and null */
+static cJSON_bool reader_other(void *context) {
+    reader_take_field(context);
+    return 1;
+}
+
+static cJSON_bool reader_boolean(void *context, cJSON_bool value) {
+    (void)value;
+    return reader_other(context);
+}
+
+/*
+ * Compile server list JSON into one block laid out exactly like the cache
+ * file: header, records, string pool. The JSON is streamed through the SAX
+ * parser, so no tree is built, and strings without escapes are copied
+ * straight from the input into the current record. Entries without host,
+ * country or city are dropped. Returns NULL on error.
+ */
+static void *build_table(const char *json, size_t json_length, size_t *table_size) {
+    static const cJSON_SaxHandler handler = {
+        reader_start_object, reader_end_container, reader_start_array,
+        reader_end_container, reader_key, reader_string, reader_number,
+        reader_boolean, reader_other};
+    struct list_reader reader;
+    char *table = NULL;
+    int i;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.field = FIELD_NONE;
+
+    if (!cJSON_ParseSaxWithLength(json, json_length, &handler, &reader) ||
+        !reader.is_array) {
+        if (!reader.is_array) {
+            fprintf(stderr, "Parse error: server list is not an array\n");
+        } else if (!reader.failed) {
+            print_parse_error(json, json_length);
+        }
+        goto cleanup;
+    }
+
+    /* Keep the pool non-empty so every table ends with a NUL */
+    if (reader.pool.size == 0) {
+        uint32_t unused;
+        if (pool_add(&reader.pool, "", &unused) != 0) {
+            goto cleanup;
+        }
+    }
+
+    size_t records_size = reader.count * sizeof(struct server_record);
+    *table_size = sizeof(struct server_cache_header) + records_size + reader.pool.size;
+    table = malloc(*table_size);
+    if (table) {
+        struct server_cache_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SERVER_CACHE_MAGIC, sizeof(header.magic));
+        header.version = SERVER_CACHE_VERSION;
+        header.record_count = (uint32_t)reader.count;
+        header.strings_size = (uint32_t)reader.pool.size;
+
+        memcpy(table, &header, sizeof(header));
+        memcpy(table + sizeof(header), reader.records, records_size);
+        memcpy(table + sizeof(header) + records_size, reader.pool.data, reader.pool.size);
+    }
+
+cleanup:
+    for (i = 0; i < FIELD_ID; i++) {
+        free(reader.strings[i].data);
+    }
+    free(reader.records);
+    pool_free(&reader.pool);
+    return table;
+}
+
+/*
+ * Check that a table is well formed and, when source is given, that it was
+ * built from a JSON file of the same mtime and size. Returns 1 if usable.
+ */
+static int table_is_valid(const void *table, size_t table_size,
+                          const struct stat *source) {
+    const struct server_cache_header *header = table;
+    const struct server_record *records;
+    const char *strings;
+    uint32_t i;
+
+    if (table_size < sizeof(*header) ||
+        memcmp(header->magic, SERVER_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SERVER_CACHE_VERSION) {
+        return 0;
+    }
+
+    if (source && (header->source_mtime_sec != (int64_t)source->st_mtim.tv_sec ||
+                   header->source_mtime_nsec != (int64_t)source->st_mtim.tv_nsec ||
+                   header->source_size != (int64_t)source->st_size)) {
+        return 0;
+    }
+
+    if (header->strings_size == 0 ||
+        (table_size - sizeof(*header)) / sizeof(struct server_record) <
+            header->record_count ||
+        table_size - sizeof(*header) -
+                (size_t)header->record_count * sizeof(struct server_record) !=
+            header->strings_size) {
+        return 0;
+    }
+
+    records = (const struct server_record *)(header + 1);
+    strings = (const char *)(records + header->record_count);
+    if (strings[header->strings_size - 1] != '\0') {
+        return 0;
+    }
+    for (i = 0; i < header->record_count; i++) {
+        if (records[i].host >= header->strings_size ||
+            records[i].country >= header->strings_size ||
+            records[i].city >= header->strings_size ||
+            records[i].provider >= header->strings_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Bounds of a name without leading and trailing whitespace */
+static void trim_name(const char *name, const char **start, const char **end) {
+    const char *last = name + strlen(name);
+
+    while (*name && isspace((unsigned char)*name)) {
+        name++;
+    }
+    while (last > name && isspace((unsigned char)last[-1])) {
+        last--;
+    }
+    *start = name;
+    *end = last;
+}
+
+/* Hash of a normalized name: trimmed and ASCII case-folded */
+static uint32_t hash_name(const char *name) {
+    const char *start;
+    const char *end;
+    uint32_t hash = 2166136261u; /* FNV-1a */
+
+    trim_name(name, &start, &end);
+    while (start < end) {
+        hash ^= (unsigned char)tolower((unsigned char)*start++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Compare two names after normalization. Returns 1 if they are equal. */
+static int names_equal(const char *a, const char *b) {
+    const char *a_end;
+    const char *b_end;
+
+    trim_name(a, &a, &a_end);
+    trim_name(b, &b, &b_end);
+    if (a_end - a != b_end - b) {
+        return 0;
+    }
+    while (a < a_end) {
+        if (tolower((unsigned char)*a++) != tolower((unsigned char)*b++)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint32_t hash_location(const char *country, const char *city) {
+    uint32_t hash = hash_name(country);
+    if (city) {
+        hash = (hash * 31u) ^ hash_name(city);
+    }
+    return hash;
+}
+
+/* Returns 1 if server belongs to the location group of country (and city) */
+static int server_in_location(const struct server *server, const char *country,
+                              const char *city) {
+    return names_equal(server->country, country) &&
+           (!city || names_equal(server->city, city));
+}
+
+/* Find the group of a location in an index, or -1 if no server is there */
+static int index_lookup(const struct server_list *list,
+                        const struct location_index *index, const char *country,
+                        const char *city) {
+    size_t slot;
+
+    if (index->slot_count == 0) {
+        return -1;
+    }
+
+    slot = hash_location(country, city) & (index->slot_count - 1);
+    while (index->slots[slot]) {
+        const struct location_group *group = &index->groups[index->slots[slot] - 1];
+        if (server_in_location(&list->servers[group->first], country, city)) {
+            return (int)(index->slots[slot] - 1);
+        }
+        slot = (slot + 1) & (index->slot_count - 1);
+    }
+    return -1;
+}
+
+/*
+ * Group servers by normalized country, or by (country, city) when by_city is
+ * set. Each server's group is stored in group_of, and index->order lists the
+ * servers of every group contiguously, in file order. Returns 0 on success.
+ */
+static int build_location_index(const struct server_list *list,
+                                struct location_index *index, int by_city,
+                                int *group_of) {
+    int count = list->count;
+    int i;
+
+    index->slot_count = 16;
+    while (index->slot_count < (size_t)count * 2) {
+        index->slot_count *= 2;
+    }
+    index->slots = calloc(index->slot_count, sizeof(uint32_t));
+    index->groups = malloc((count ? count : 1) * sizeof(struct location_group));
+    index->order = malloc((count ? count : 1) * sizeof(int));
+    if (!index->slots || !index->groups || !index->order) {
+        return -1;
+    }
+
+    index->group_count = 0;
+    for (i = 0; i < count; i++) {
+        const struct server *server = &list->servers[i];
+        const char *city = by_city ? server->city : NULL;
+        size_t slot = hash_location(server->country, city) & (index->slot_count - 1);
+        struct location_group *group = NULL;
+
+        while (index->slots[slot]) {
+            group = &index->groups[index->slots[slot] - 1];
+            if (server_in_location(&list->servers[group->first], server->country,
+                                   city)) {
+                break;
+            }
+            group = NULL;
+            slot = (slot + 1) & (index->slot_count - 1);
+        }
+
+        if (!group) {
+            group = &index->groups[index->group_count];
+            group->first = i;
+            group->start = 0;
+            group->count = 0;
+            index->slots[slot] = (uint32_t)++index->group_count;
+        }
+        group->count++;
+        group_of[i] = (int)(group - index->groups);
+    }
+
+    /* Counting sort: turn group sizes into slice starts, then place servers */
+    int start = 0;
+    for (i = 0; i < index->group_count; i++) {
+        index->groups[i].start = start;
+        start += index->groups[i].count;
+        index->groups[i].count = 0;
+    }
+    for (i = 0; i < count; i++) {
+        struct location_group *group = &index->groups[group_of[i]];
+        index->order[group->start + group->count++] = i;
+    }
+
+    return 0;
+}
+
+static void free_location_index(struct location_index *index) {
+    free(index->slots);
+    free(index->groups);
+    free(index->order);
+}
+
+/*
+ * Decode a validated table into the flat server array and build the location
+ * indexes used by selection. Returns 0 on success.
+ */
+static int attach_table(struct server_list *list, const void *table) {
+    const struct server_cache_header *header = table;
+    const struct server_record *records = (const struct server_record *)(header + 1);
+    const char *strings = (const char *)(records + header->record_count);
+    size_t count = header->record_count;
+    size_t i;
+
+    list->servers = malloc((count ? count : 1) * sizeof(struct server));
+    list->country_group = malloc((count ? count : 1) * sizeof(int));
+    list->city_group = malloc((count ? count : 1) * sizeof(int));
+    if (!list->servers || !list->country_group || !list->city_group) {
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct server *server = &list->servers[i];
+        server->host = strings + records[i].host;
+        server->country = strings + records[i].country;
+        server->city = strings + records[i].city;
+        server->provider = strings + records[i].provider;
+        server->id = records[i].id;
+    }
+
+    list->strings = strings;
+    list->count = (int)count;
+
+    if (build_location_index(list, &list->countries, 0, list->country_group) != 0 ||
+        build_location_index(list, &list->cities, 1, list->city_group) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Map an up-to-date cache file. Returns 1 if the list now uses it. */
+static int map_cache(struct server_list *list, const char *cache_path,
+                     const struct stat *source) {
+    struct stat cache_stat;
+    int fd = open(cache_path, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &cache_stat) != 0 || cache_stat.st_size <= 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)cache_stat.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+
+    if (!table_is_valid(mapping, size, source)) {
+        munmap(mapping, size);
+        return 0;
+    }
+
+    list->mapping = mapping;
+    list->mapping_size = size;
+    return attach_table(list, mapping) == 0;
+}
+
+/*
+ * Write the table next to the JSON source. The file is written under a
+ * temporary name and renamed so concurrent runs never map a partial cache.
+ */
+static void write_cache(const char *cache_path, const void *table,
+                        size_t table_size) {
+    char *tmp_path = malloc(strlen(cache_path) + 32);
+    if (!tmp_path) {
+        return;
+    }
+    sprintf(tmp_path, "%s.%ld.tmp", cache_path, (long)getpid());
+
+    FILE *stream = fopen(tmp_path, "wb");
+    if (!stream) {
+        free(tmp_path);
+        return;
+    }
+
+    int ok = fwrite(table, 1, table_size, stream) == table_size;
+    if (fclose(stream) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp_path, cache_path) != 0) {
+        fprintf(stderr, "Warning: Failed to write server cache: %s\n", cache_path);
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+}
+
+struct server_list *server_list_load(const char *json_path) {
+    struct stat source;
+
+    if (stat(json_path, &source) != 0) {
+        fprintf(stderr, "Error opening file: %s\n", json_path);
+        return NULL;
+    }
+
+    struct server_list *list = calloc(1, sizeof(struct server_list));
+    char *cache_path = malloc(strlen(json_path) + sizeof(SERVER_CACHE_SUFFIX));
+    if (!list || !cache_path) {
+        free(list);
+        free(cache_path);
+        return NULL;
+    }
+    strcpy(cache_path, json_path);
+    strcat(cache_path, SERVER_CACHE_SUFFIX);
+
+    if (map_cache(list, cache_path, &source)) {
+        free(cache_path);
+        return list;
+    }
+    if (list->mapping) {
+        /* Mapped but could not be decoded: out of memory */
+        free(cache_path);
+        server_list_free(list);
+        return NULL;
+    }
+
+    /* Cache missing or stale: compile the JSON and refresh the cache */
+    size_t json_length = 0;
+    const char *json = map_file(json_path, &json_length);
+    if (!json) {
+        free(cache_path);
+        free(list);
+        return NULL;
+    }
+
+    size_t table_size = 0;
+    void *table = build_table(json, json_length, &table_size);
+    unmap_file(json, json_length);
+    if (!table) {
+        fprintf(stderr, "Error: Failed to build server table: %s\n", json_path);
+        free(cache_path);
+        free(list);
+        return NULL;
+    }
+
+    struct server_cache_header *header = table;
+    header->source_mtime_sec = (int64_t)source.st_mtim.tv_sec;
+    header->source_mtime_nsec = (int64_t)source.st_mtim.tv_nsec;
+    header->source_size = (int64_t)source.st_size;
+    write_cache(cache_path, table, table_size);
+
+    list->heap = table;
+    free(cache_path);
+    if (attach_table(list, table) != 0) {
+        server_list_free(list);
+        return NULL;
+    }
+    return list;
+}
+
+void server_list_free(struct server_list *list) {
+    if (!list) {
+        return;
+    }
+    if (list->mapping) {
+        munmap(list->mapping, list->mapping_size);
+    }
+    free(list->heap);
+    free(list->servers);
+    free(list->country_group);
+    free(list->city_group);
+    free_location_index(&list->countries);
+    free_location_index(&list->cities);
+    free(list);
+}
+
+int server_list_find_country(const struct server_list *list, const char *country,
+                             struct server_slice *slice) {
+    int group = index_lookup(list, &list->countries, country, NULL);
+    if (group < 0) {
+        return 0;
+    }
+    slice->indices = list->countries.order + list->countries.groups[group].start;
+    slice->count = list->countries.groups[group].count;
+    slice->group = group;
+    return 1;
+}
+
+int server_list_find_city(const struct server_list *list, const char *country,
+                          const char *city, struct server_slice *slice) {
+    int group = index_lookup(list, &list->cities, country, city);
+    if (group < 0) {
+        return 0;
+    }
+    slice->indices = list->cities.order + list->cities.groups[group].start;
+    slice->count = list->cities.groups[group].count;
+    slice->group = group;
+    return 1;
+}
@@ -0,0 +1,104 @@
+#ifndef SERVER_LIST_H
+#define SERVER_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compiled form of speedtest_server_list.json. The table is a fixed-width
+ * record array followed by a pool of NUL-terminated strings that the records
+ * reference by offset. Strings are interned, so records with the same country
+ * share one country offset. The same layout is written to a cache file next
+ * to the JSON source, so later runs can mmap it instead of parsing JSON.
+ */
+#define SERVER_CACHE_SUFFIX ".cache"
+#define SERVER_CACHE_MAGIC "STSRVTBL"
+#define SERVER_CACHE_VERSION 2
+
+struct server_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+    int64_t source_mtime_sec;  /* mtime of the JSON the cache was built from */
+    int64_t source_mtime_nsec;
+    int64_t source_size;       /* Size of the JSON the cache was built from */
+};
+
+/* Fields are offsets into the string pool */
+struct server_record {
+    uint32_t host;
+    uint32_t country;
+    uint32_t city;
+    uint32_t provider;
+    int32_t id;
+};
+
+/* One server with its strings resolved */
+struct server {
+    const char *host;
+    const char *country;
+    const char *city;
+    const char *provider;
+    int id;
+};
+
+/* Servers of one location, as a slice of a location index's order array */
+struct location_group {
+    int start;
+    int count;
+    int first; /* A member server, used to compare names on lookup */
+};
+
+/*
+ * Hash index from a normalized location (trimmed, ASCII case-folded) to the
+ * slice of order that holds its servers, in file order.
+ */
+struct location_index {
+    uint32_t *slots; /* Open-addressing table of group + 1, 0 when empty */
+    size_t slot_count;
+    struct location_group *groups;
+    int group_count;
+    int *order;
+};
+
+/* Servers in file order, indexed by country and by (country, city) */
+struct server_list {
+    struct server *servers;
+    int count;
+    struct location_index countries;
+    struct location_index cities;
+    int *country_group; /* Group of each server in countries */
+    int *city_group;    /* Group of each server in cities */
+    const char *strings;
+    void *mapping;      /* mmapped cache file, or NULL */
+    size_t mapping_size;
+    void *heap;         /* Table built in memory when no cache was usable */
+};
+
+/* Indices of the servers in one location group */
+struct server_slice {
+    const int *indices;
+    int count;
+    int group;
+};
+
+/*
+ * Load the server table for a JSON server list, using the cache when it is
+ * still valid and rebuilding it otherwise. Returns NULL on error.
+ */
+struct server_list *server_list_load(const char *json_path);
+void server_list_free(struct server_list *list);
+
+/*
+ * Find the servers in a country, or in a city of a country. Names match
+ * ignoring case and surrounding whitespace. Return 1 and fill slice if any
+ * server is there, 0 otherwise.
+ */
+int server_list_find_country(const struct server_list *list, const char *country,
+                             struct server_slice *slice);
+int server_list_find_city(const struct server_list *list, const char *country,
+                          const char *city, struct server_slice *slice);
+
+#endif
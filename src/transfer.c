@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "transfer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRANSFER_MAX_EVENTS 64
+#define TRANSFER_MAX_WAIT_MS 1000 /* Bound on a sleep in case curl misses a timer */
+
+/* A running job, kept in a list so the engine can abandon what is left */
+struct transfer_job {
+    CURL *curl;
+    transfer_done_fn done;
+    void *context;
+    struct transfer_job *prev;
+    struct transfer_job *next;
+};
+
+struct transfer_engine {
+    CURLM *multi;
+    CURLSH *share;          /* Session of the jobs, or NULL */
+    int epoll_fd;
+    double timer_deadline;  /* Monotonic time curl wants to be called, -1 if none */
+    struct transfer_job *jobs;
+    int stopped;
+};
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+ * Session shared by the jobs: DNS answers, open connections and TLS
+ * sessions, so a host probed once is then tested over the same connection,
+ * without another lookup or handshake. Jobs run on one thread, so no
+ * locking is needed. Returns NULL if libcurl can't share.
+ */
+static CURLSH *create_share(void) {
+    CURLSH *share = curl_share_init();
+    if (!share) {
+        return NULL;
+    }
+    if (curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK ||
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) {
+        curl_share_cleanup(share);
+        return NULL;
+    }
+    return share;
+}
+
+/* CURLMOPT_SOCKETFUNCTION: mirror the sockets curl waits on in the epoll set */
+static int socket_callback(CURL *curl, curl_socket_t fd, int what, void *userp,
+                           void *socketp) {
+    struct transfer_engine *engine = userp;
+    struct epoll_event event;
+    (void)curl;
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        curl_multi_assign(engine->multi, fd, NULL);
+        return 0;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+                   ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    /* socketp marks a socket already in the set */
+    if (socketp) {
+        return epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0 ? 0 : -1;
+    }
+    if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0 &&
+        (errno != EEXIST || epoll_ctl(engine->epoll_fd, EPOLL_CTL_MOD, fd, &event) != 0)) {
+        return -1;
+    }
+    curl_multi_assign(engine->multi, fd, engine);
+    return 0;
+}
+
+/* CURLMOPT_TIMERFUNCTION: remember when curl wants to handle its timeouts */
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    struct transfer_engine *engine = userp;
+    (void)multi;
+
+    engine->timer_deadline = timeout_ms < 0 ? -1.0
+                                            : monotonic_seconds() + timeout_ms / 1000.0;
+    return 0;
+}
+
+struct transfer_engine *transfer_engine_create(void) {
+    struct transfer_engine *engine = calloc(1, sizeof(struct transfer_engine));
+    if (!engine) {
+        return NULL;
+    }
+
+    engine->timer_deadline = -1.0;
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->multi = curl_multi_init();
+    if (engine->epoll_fd < 0 || !engine->multi) {
+        if (engine->epoll_fd >= 0) {
+            close(engine->epoll_fd);
+        }
+        if (engine->multi) {
+            curl_multi_cleanup(engine->multi);
+        }
+        free(engine);
+        return NULL;
+    }
+    /* Without sharing each job just opens its own connection */
+    engine->share = create_share();
+
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+    return engine;
+}
+
+/* Take a job's handle out of the engine and return its job */
+static struct transfer_job *detach(struct transfer_engine *engine, CURL *curl) {
+    struct transfer_job *job = NULL;
+
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&job);
+    if (!job) {
+        return NULL;
+    }
+    curl_multi_remove_handle(engine->multi, curl);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+
+    if (job->prev) {
+        job->prev->next = job->next;
+    } else {
+        engine->jobs = job->next;
+    }
+    if (job->next) {
+        job->next->prev = job->prev;
+    }
+    return job;
+}
+
+void transfer_engine_free(struct transfer_engine *engine) {
+    if (!engine) {
+        return;
+    }
+    while (engine->jobs) {
+        free(detach(engine, engine->jobs->curl));
+    }
+    curl_multi_cleanup(engine->multi);
+    if (engine->share) {
+        curl_share_cleanup(engine->share);
+    }
+    close(engine->epoll_fd);
+    free(engine);
+}
+
+int transfer_engine_add(struct transfer_engine *engine, CURL *curl,
+                        transfer_done_fn done, void *context) {
+    struct transfer_job *job = malloc(sizeof(struct transfer_job));
+    if (!job) {
+        return -1;
+    }
+    job->curl = curl;
+    job->done = done;
+    job->context = context;
+
+    curl_easy_setopt(curl, CURLOPT_SHARE, engine->share);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)job);
+    if (curl_multi_add_handle(engine->multi, curl) != CURLM_OK) {
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+        free(job);
+        return -1;
+    }
+
+    job->prev = NULL;
+    job->next = engine->jobs;
+    if (engine->jobs) {
+        engine->jobs->prev = job;
+    }
+    engine->jobs = job;
+    return 0;
+}
+
+void transfer_engine_remove(struct transfer_engine *engine, CURL *curl) {
+    free(detach(engine, curl));
+}
+
+void transfer_engine_stop(struct transfer_engine *engine) {
+    engine->stopped = 1;
+}
+
+/* Hand the finished transfers back through their done functions */
+static void finish_jobs(struct transfer_engine *engine) {
+    CURLMsg *msg;
+    int msgs_left;
+
+    while ((msg = curl_multi_info_read(engine->multi, &msgs_left))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        CURL *curl = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        struct transfer_job *job = detach(engine, curl);
+        if (job) {
+            transfer_done_fn done = job->done;
+            void *context = job->context;
+            free(job);
+            done(curl, result, context);
+        }
+    }
+}
+
+int transfer_engine_run(struct transfer_engine *engine) {
+    struct epoll_event events[TRANSFER_MAX_EVENTS];
+    int running;
+    int i;
+
+    engine->stopped = 0;
+    while (engine->jobs && !engine->stopped) {
+        int wait_ms = TRANSFER_MAX_WAIT_MS;
+        if (engine->timer_deadline >= 0) {
+            double left_ms = (engine->timer_deadline - monotonic_seconds()) * 1000.0;
+            wait_ms = left_ms <= 0 ? 0 : left_ms < wait_ms ? (int)left_ms + 1 : wait_ms;
+        }
+
+        int count = epoll_wait(engine->epoll_fd, events, TRANSFER_MAX_EVENTS, wait_ms);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        for (i = 0; i < count; i++) {
+            int action = 0;
+            if (events[i].events & EPOLLIN) {
+                action |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                action |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                action |= CURL_CSELECT_ERR;
+            }
+            curl_multi_socket_action(engine->multi, events[i].data.fd, action, &running);
+        }
+
+        /* Also runs when sockets are busy, so no timeout is starved */
+        if (count == 0 || (engine->timer_deadline >= 0 &&
+                           monotonic_seconds() >= engine->timer_deadline)) {
+            engine->timer_deadline = -1.0;
+            curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+
+        finish_jobs(engine);
+    }
+
+    engine->stopped = 0;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <curl/curl.h>
+
+/*
+ * Single-threaded transfer engine: every request of a run is a job on one
+ * curl multi handle, driven by curl_multi_socket_action from an epoll loop
+ * that sleeps until a socket is ready or curl's next timeout. The engine
+ * also owns the run's session, so its jobs share DNS answers, connections
+ * and TLS sessions.
+ *
+ * A job is a configured easy handle and a function called once it is done.
+ * The engine uses the handle's CURLOPT_PRIVATE and CURLOPT_SHARE.
+ */
+struct transfer_engine;
+
+/*
+ * Called when a job's transfer ends, after its handle has left the engine.
+ * The handle stays the caller's: it may clean it up or add it again.
+ */
+typedef void (*transfer_done_fn)(CURL *curl, CURLcode result, void *context);
+
+/* Returns NULL on error */
+struct transfer_engine *transfer_engine_create(void);
+
+/* Abandons any jobs still running; their handles stay the caller's */
+void transfer_engine_free(struct transfer_engine *engine);
+
+/* Start a job. Returns 0 on success, -1 on error. */
+int transfer_engine_add(struct transfer_engine *engine, CURL *curl,
+                        transfer_done_fn done, void *context);
+
+/* Abandon a job without calling its done function. No-op for other handles. */
+void transfer_engine_remove(struct transfer_engine *engine, CURL *curl);
+
+/*
+ * Run jobs, including ones added from done functions, until none is left or
+ * transfer_engine_stop is called. Returns 0, or -1 if the loop failed.
+ */
+int transfer_engine_run(struct transfer_engine *engine);
+
+/* From a done function: make transfer_engine_run return before it waits again */
+void transfer_engine_stop(struct transfer_engine *engine);
+
+#endif